@@ -3,6 +3,8 @@
 #include <iostream>
 #include <string>
 #include <exception>
+#include <algorithm>
+#include <chrono>
 #include "Packet/PacketHandler.h"
 #include "Exception/StartupException.h"
 #include <winsock2.h>
@@ -28,13 +30,21 @@ ChatClient::ChatClient() :
 	cSocket(INVALID_SOCKET),
 	username(""),
 	password(""),
+	resumeToken(""),
+	resuming(false),
+	reconnectAttempts(0),
 	ip(""),
 	port(0),
 	connected(false),
 	consoleRenderer(new ConsoleHandler()),
 	inRoom(nullptr),
 	friendsList(nullptr),
-	friendsListSize(0) {
+	friendsListSize(0),
+	roomListVersion(0),
+	memberListVersion(0),
+	largeRoom(false),
+	memberCount(0),
+	memberPage(0) {
 }
 
 void ChatClient::connectionDetailsPrompt() {
@@ -121,6 +131,55 @@ void ChatClient::start() {
 	*p << VERSION_CODE;
 	packetHandler->finializePacket(p, true);
 	readInstance.join();
+	while(!resumeToken.empty() && reconnect()) {
+		readInstance.join();
+	}
+}
+
+/* Quietly opens a new connection to the server for reconnect(). Returns INVALID_SOCKET if the server couldn't be reached. */
+SOCKET ChatClient::openSocket() {
+	struct addrinfo socketSpecifications;
+	struct addrinfo* socketResult = nullptr;
+	ZeroMemory(&socketSpecifications, sizeof(socketSpecifications));
+	socketSpecifications.ai_family = AF_UNSPEC;
+	socketSpecifications.ai_socktype = SOCK_STREAM;
+	socketSpecifications.ai_protocol = IPPROTO_TCP;
+	if(getaddrinfo(ip.c_str(), to_string(port).c_str(), &socketSpecifications, &socketResult) != 0)
+		return INVALID_SOCKET;
+	SOCKET newSocket = socket(socketResult->ai_family, socketResult->ai_socktype, socketResult->ai_protocol);
+	if(newSocket != INVALID_SOCKET && connect(newSocket, socketResult->ai_addr, (int)socketResult->ai_addrlen) == SOCKET_ERROR) {
+		closesocket(newSocket);
+		newSocket = INVALID_SOCKET;
+	}
+	freeaddrinfo(socketResult);
+	return newSocket;
+}
+
+/* Reconnects after losing the connection, such as when the server restarts, and resumes the session with the token the server gave us.
+	Gives up after RECONNECT_ATTEMPTS tries without getting back into the session. Returns false once it has given up.
+*/
+bool ChatClient::reconnect() {
+	consoleRenderer->pushBodyMessage("Lost connection to the server, reconnecting...", ERROR_COLOR);
+	while(reconnectAttempts < RECONNECT_ATTEMPTS) {
+		reconnectAttempts++;
+		this_thread::sleep_for(chrono::milliseconds(RECONNECT_DELAY_MS));
+		SOCKET newSocket = openSocket();
+		if(newSocket == INVALID_SOCKET)
+			continue;
+		lock_guard<mutex> lock(handlerMutex);
+		delete packetHandler;
+		cSocket = newSocket;
+		connected = true;
+		setInRoom(false);
+		packetHandler = new PacketHandler(this, cSocket);
+		readInstance = thread(&PacketHandler::readLoop, packetHandler);
+		Packet* p = packetHandler->constructPacket(HANDSHAKE_PACKET_ID);
+		*p << VERSION_CODE;
+		packetHandler->finializePacket(p, true);
+		return true;
+	}
+	consoleRenderer->pushBodyMessage("Could not reconnect to the server.", ERROR_COLOR);
+	return false;
 }
 
 /* Sets the client to a disconnected state. */
@@ -154,6 +213,28 @@ void ChatClient::doCredentials(bool retryPassword) {
 	packetHandler->finializePacket(p, true);
 }
 
+/* Asks the server to resume our last session, if we've been given a token for one. Returns false if there is nothing to resume. */
+bool ChatClient::resumeSession() {
+	if(resumeToken.empty())
+		return false;
+	resuming = true;
+	Packet* p = packetHandler->constructPacket(RESUME_PACKET_ID);
+	*p << username;
+	*p << resumeToken;
+	packetHandler->finializePacket(p, true);
+	return true;
+}
+
+/* Returns true while waiting to hear back about resuming a session. */
+bool ChatClient::isResuming() {
+	return resuming;
+}
+
+/* Sets the token the session can be resumed with, an empty token stops the client from reconnecting. */
+void ChatClient::setResumeToken(string resumeToken) {
+	this->resumeToken = resumeToken;
+}
+
 /* Returns the client's username. */
 string ChatClient::getUsername() {
 	return username;
@@ -174,15 +255,27 @@ bool ChatClient::isInRoom() {
 	return inRoom;
 }
 
-/* Going to the lobby will begin the thread for input. */
+/* Going to the lobby will begin the thread for input, which keeps running when the session is resumed after reconnecting. */
 void ChatClient::gotoLobby() {
-	inputInstance = thread(&ChatClient::messagePrompt, this);
+	if(resuming)
+		consoleRenderer->pushBodyMessage("Reconnected.", DEFAULT_COLOR);
+	resuming = false;
+	reconnectAttempts = 0;
+	if(!inputInstance.joinable())
+		inputInstance = thread(&ChatClient::messagePrompt, this);
 }
 
-/* Loops continuously to take user input and sends it to the server. */
+/* Loops continuously to take user input and sends it to the server.
+	While reconnecting input is still taken, but messages can't be sent.
+*/
 void ChatClient::messagePrompt() {
-	while(connected) {
+	while(connected || !resumeToken.empty()) {
 		string message = consoleRenderer->getBlockingInput();
+		lock_guard<mutex> lock(handlerMutex);
+		if(!connected) {
+			consoleRenderer->pushBodyMessage("Not connected, your message wasn't sent.", ERROR_COLOR);
+			continue;
+		}
 		Packet* p = packetHandler->constructPacket(MESSAGE_PACKET_ID);
 		*p << message;
 		packetHandler->finializePacket(p, true);
@@ -215,6 +308,126 @@ unsigned short ChatClient::getFriendsListSize() {
 	return friendsListSize;
 }
 
+/* Replaces the room list with a full copy sent by the server and redraws it. */
+void ChatClient::setRoomList(unsigned int version, const vector<RoomEntry>& roomList) {
+	this->roomList = roomList;
+	roomListVersion = version;
+	drawRoomList();
+}
+
+/* Applies a batch of room list changes from the server.
+	Returns false without changing anything if the batch doesn't directly follow our version, meaning a full copy of the list is needed.
+*/
+bool ChatClient::applyRoomListDeltas(unsigned int version, const vector<unsigned short>& types, const vector<RoomEntry>& entries) {
+	if(version != roomListVersion + 1)
+		return false;
+	for(size_t i = 0; i < types.size(); i++) {
+		const string& findName = entries[i].name;
+		auto found = find_if(roomList.begin(), roomList.end(), [&findName](const RoomEntry& room) { return room.name == findName; });
+		switch(types[i]) {
+			case ROOM_LIST_DELTA_ADDED:
+			case ROOM_LIST_DELTA_COUNT:
+				if(found == roomList.end())
+					roomList.push_back(entries[i]);
+				else
+					*found = entries[i];
+				break;
+			case ROOM_LIST_DELTA_REMOVED:
+				if(found != roomList.end())
+					roomList.erase(found);
+				break;
+		}
+	}
+	roomListVersion = version;
+	drawRoomList();
+	return true;
+}
+
+/* Draws the room list into the top right widget while in the lobby. */
+void ChatClient::drawRoomList() {
+	if(isInRoom())
+		return;
+	unsigned short roomCount = (unsigned short)roomList.size();
+	string* roomNames = new string[roomCount];
+	unsigned short* roomColors = new unsigned short[roomCount];
+	for(unsigned short i = 0; i < roomCount; i++) {
+		roomNames[i] = roomList[i].name + " (" + to_string(roomList[i].userCount) + ")";
+		roomColors[i] = DEFAULT_COLOR;
+	}
+	consoleRenderer->updateTopRight(roomNames, roomColors, roomCount);
+	delete[] roomNames;
+	delete[] roomColors;
+}
+
+/* Replaces the room member list with a full copy sent by the server and redraws it. */
+void ChatClient::setMemberList(unsigned int version, const vector<MemberEntry>& memberList) {
+	this->memberList = memberList;
+	memberListVersion = version;
+	largeRoom = false;
+	drawMemberList();
+}
+
+/* Shows a single page of a large room's member list, only the member count is kept up to date afterwards. */
+void ChatClient::setMemberPage(unsigned short memberCount, unsigned short page, const vector<MemberEntry>& memberList) {
+	this->memberList = memberList;
+	this->memberCount = memberCount;
+	memberPage = page;
+	largeRoom = true;
+	drawMemberList();
+}
+
+/* Updates the member count shown for a large room. */
+void ChatClient::setMemberCount(unsigned short memberCount) {
+	this->memberCount = memberCount;
+	drawMemberList();
+}
+
+/* Applies a single member list change from the server.
+	Returns false without changing anything if the change doesn't directly follow our version, meaning a full copy of the list is needed.
+*/
+bool ChatClient::applyMemberDelta(unsigned int version, unsigned short type, const MemberEntry& member) {
+	if(version != memberListVersion + 1)
+		return false;
+	auto found = find_if(memberList.begin(), memberList.end(), [&member](const MemberEntry& entry) { return entry.name == member.name; });
+	switch(type) {
+		case ROOM_MEMBER_ADDED:
+		case ROOM_MEMBER_RECOLORED:
+			if(found == memberList.end())
+				memberList.push_back(member);
+			else
+				found->color = member.color;
+			break;
+		case ROOM_MEMBER_REMOVED:
+			if(found != memberList.end())
+				memberList.erase(found);
+			break;
+	}
+	memberListVersion = version;
+	drawMemberList();
+	return true;
+}
+
+/* Draws the room member list into the top right widget while inside a room. */
+void ChatClient::drawMemberList() {
+	if(!isInRoom())
+		return;
+	unsigned short offset = (largeRoom ? 1 : 0);
+	unsigned short userCount = (unsigned short)memberList.size() + offset;
+	string* userNames = new string[userCount];
+	unsigned short* userColors = new unsigned short[userCount];
+	if(largeRoom) {
+		userNames[0] = to_string(memberCount) + " users, pg " + to_string(memberPage + 1);
+		userColors[0] = BORDER_COLOR;
+	}
+	for(unsigned short i = offset; i < userCount; i++) {
+		userNames[i] = memberList[i - offset].name;
+		userColors[i] = memberList[i - offset].color;
+	}
+	consoleRenderer->updateTopRight(userNames, userColors, userCount);
+	delete[] userNames;
+	delete[] userColors;
+}
+
 ChatClient::~ChatClient() {
 	if(inputInstance.joinable())
 		inputInstance.join();
@@ -4,21 +4,39 @@
 #include <ws2tcpip.h>
 #include <string>
 #include <thread>
+#include <mutex>
+#include <vector>
 #include "Packet/PacketHandler.h"
 #include "UI/ConsoleHandler.h"
 #include "Friend.h"
 
 #pragma comment(lib, "Ws2_32.lib")
 
+/* A room as shown inside the lobby's room list. */
+struct RoomEntry {
+	std::string name;
+	unsigned short userCount;
+};
+
+/* A user as shown inside the room's member list. */
+struct MemberEntry {
+	std::string name;
+	unsigned short color;
+};
+
 class ChatClient {
 public:
 	ChatClient();
 	~ChatClient();
 	void connectionDetailsPrompt();
 	void start();
+	bool reconnect();
 	void gotoLobby();
 	void messagePrompt();
 	void doCredentials(bool retryPassword = false);
+	bool resumeSession();
+	bool isResuming();
+	void setResumeToken(std::string resumeToken);
 	void disconnect();
 	std::string getUsername();
 	std::string getPassword();
@@ -29,6 +47,14 @@ public:
 	Friend** const getFriendsList();
 	bool isFriend(std::string name);
 	unsigned short getFriendsListSize();
+	void setRoomList(unsigned int version, const std::vector<RoomEntry>& roomList);
+	bool applyRoomListDeltas(unsigned int version, const std::vector<unsigned short>& types, const std::vector<RoomEntry>& entries);
+	void drawRoomList();
+	void setMemberList(unsigned int version, const std::vector<MemberEntry>& memberList);
+	bool applyMemberDelta(unsigned int version, unsigned short type, const MemberEntry& member);
+	void setMemberPage(unsigned short memberCount, unsigned short page, const std::vector<MemberEntry>& memberList);
+	void setMemberCount(unsigned short memberCount);
+	void drawMemberList();
 private:
 	unsigned int port;
 	std::string ip;
@@ -38,11 +64,22 @@ private:
 	PacketHandler* packetHandler;
 	std::string username;
 	std::string password;
+	std::string resumeToken;
+	bool resuming;
+	unsigned short reconnectAttempts;
+	std::mutex handlerMutex;
 	unsigned short friendsListSize;
 	Friend** friendsList;
 	bool connected;
 	bool inRoom;
 	ConsoleHandler* consoleRenderer;
-
+	std::vector<RoomEntry> roomList;
+	unsigned int roomListVersion;
+	std::vector<MemberEntry> memberList;
+	unsigned int memberListVersion;
+	bool largeRoom;
+	unsigned short memberCount;
+	unsigned short memberPage;
+	SOCKET openSocket();
 };
 #endif //CHAT_CLIENT_H_
\ No newline at end of file
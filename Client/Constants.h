@@ -9,6 +9,7 @@
 #define AUTHENTICATION_SUCCESS 2
 #define AUTHENTICATION_FAILURE 3
 #define AUTHENTICATION_INVALID_USERNAME 4
+#define AUTHENTICATION_RESUME_REJECTED 5
 #define MESSAGE_PACKET_ID 3
 #define ATTEMPT_JOIN_ROOM_PACKET_ID 4
 #define ATTEMPT_JOIN_ROOM_SUCCESS 0
@@ -21,6 +22,25 @@
 #define REMOVE_FRIEND_PACKET_ID 10
 #define FRIEND_STATUS_PACKET_ID 11
 #define FRIENDS_LIST_PACKET_ID 12
+#define ROOM_LIST_DELTA_PACKET_ID 13
+#define ROOM_LIST_DELTA_ADDED 0
+#define ROOM_LIST_DELTA_REMOVED 1
+#define ROOM_LIST_DELTA_COUNT 2
+#define ROOM_LIST_RESYNC_PACKET_ID 14
+#define ROOM_MEMBER_DELTA_PACKET_ID 15
+#define ROOM_MEMBER_ADDED 0
+#define ROOM_MEMBER_REMOVED 1
+#define ROOM_MEMBER_RECOLORED 2
+#define ROOM_MEMBER_RESYNC_PACKET_ID 16
+#define ROOM_MEMBER_COUNT_PACKET_ID 17
+#define ROOM_MEMBER_PAGE_PACKET_ID 18
+#define FRIEND_PRESENCE_BATCH_PACKET_ID 19
+#define OFFLINE_MESSAGES_PACKET_ID 20
+#define OFFLINE_MESSAGES_ACK_PACKET_ID 21
+#define RESUME_PACKET_ID 22
+#define RESUME_TOKEN_PACKET_ID 23
+#define RECONNECT_ATTEMPTS 10
+#define RECONNECT_DELAY_MS 2000
 
 #define ERROR_COLOR 12
 #define FRIEND_COLOR 10
@@ -28,5 +48,7 @@
 #define DEFAULT_COLOR 15
 #define BORDER_COLOR 8
 
-#define VERSION_CODE "Drocsid 0.4"
+#define VERSION_CODE "Drocsid 0.6"
+#define WIRE_FORMAT_LEGACY 0
+#define WIRE_FORMAT_COMPACT 1
 #endif //CONSTANTS_H_
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include "DataStream.h"
+#include "../Constants.h"
 #include <string>
 #include <iostream>
 using namespace std;
 
+#define FLAG_BITS 8
+
 Cursor::Cursor(unsigned short size) : size(size), position(0) {
 
 }
@@ -61,7 +64,15 @@ void Cursor::reset() {
 	position = 0;
 }
 
-DataStream::DataStream(unsigned short size) : size(size), readIndex(size), writeIndex(size) {
+DataStream::DataStream(unsigned short size) :
+	size(size),
+	readIndex(size),
+	writeIndex(size),
+	wireFormat(WIRE_FORMAT_LEGACY),
+	writeFlagPosition(0),
+	writeFlagBits(FLAG_BITS),
+	readFlagPosition(0),
+	readFlagBits(FLAG_BITS) {
 	inBuf = new char[size];
 	outBuf = new char[size];
 	resetRead();
@@ -93,9 +104,63 @@ Cursor& DataStream::getReadIndex() {
 	return readIndex;
 }
 
+/* Sets the format values are written and read in, see the WIRE_FORMAT constants.
+	The legacy format uses fixed size values: packet ids as ints, shorts and string lengths as 2 bytes and a byte per boolean.
+	The compact format writes packet ids, ints (zigzag encoded), shorts and string lengths as varints, and packs the booleans of a packet 8 to a byte.
+*/
+void DataStream::setWireFormat(unsigned short wireFormat) {
+	this->wireFormat = wireFormat;
+}
+
+/* Returns the format values are written and read in. */
+unsigned short DataStream::getWireFormat() {
+	return wireFormat;
+}
+
+/* Starts a packet in the output stream by writing its id. The packet's booleans start a new flag byte. */
+void DataStream::writePacketId(unsigned short packetId) {
+	writeFlagBits = FLAG_BITS;
+	if(wireFormat == WIRE_FORMAT_COMPACT)
+		writeVarint(packetId);
+	else
+		*this << (int)packetId;
+}
+
+/* Starts reading the next packet in the input stream, returning its id. */
+int DataStream::readPacketId() {
+	readFlagBits = FLAG_BITS;
+	if(wireFormat == WIRE_FORMAT_COMPACT)
+		return (int)readVarint();
+	int packetId = 0;
+	*this >> packetId;
+	return packetId;
+}
+
+/* Writes a value 7 bits at a time, low bits first, with the high bit set on every byte but the last. */
+void DataStream::writeVarint(unsigned int value) {
+	while(value >= 0x80) {
+		outBuf[writeIndex++] = (char)((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	outBuf[writeIndex++] = (char)value;
+}
+
+/* Reads a value written by writeVarint(). */
+unsigned int DataStream::readVarint() {
+	unsigned int value = 0;
+	for(unsigned int shift = 0; shift < 35; shift += 7) {
+		unsigned char byte = (unsigned char)inBuf[readIndex++];
+		value |= (unsigned int)(byte & 0x7F) << shift;
+		if(!(byte & 0x80))
+			return value;
+	}
+	throw exception("Varint too long");
+}
+
 /* Resets the write cursor and output buffer. */
 void DataStream::resetWrite() {
 	writeIndex.reset();
+	writeFlagBits = FLAG_BITS;
 	for(unsigned short i = 0; i < size; i++) {
 		outBuf[i] = '\0';
 	}
@@ -104,6 +169,7 @@ void DataStream::resetWrite() {
 /* Resets the read cursor and input buffer. */
 void DataStream::resetRead() {
 	readIndex.reset();
+	readFlagBits = FLAG_BITS;
 	for(unsigned short i = 0; i < size; i++) {
 		inBuf[i] = '\0';
 	}
@@ -111,6 +177,10 @@ void DataStream::resetRead() {
 
 /* Writes an integer to the output stream. */
 DataStream& operator<<(DataStream& dataStream, const int& toWrite) {
+	if(dataStream.wireFormat == WIRE_FORMAT_COMPACT) {
+		dataStream.writeVarint(((unsigned int)toWrite << 1) ^ (unsigned int)(toWrite >> 31));
+		return dataStream;
+	}
 	Cursor& idx = dataStream.getWriteIndex();
 	char* buf = dataStream.getOutputBuffer();
 	buf[idx++] = (toWrite >> 24) & 0xFF;
@@ -122,6 +192,11 @@ DataStream& operator<<(DataStream& dataStream, const int& toWrite) {
 
 /* Reads an integer from the input stream. */
 DataStream& operator>>(DataStream& dataStream, int& toRead) {
+	if(dataStream.wireFormat == WIRE_FORMAT_COMPACT) {
+		unsigned int value = dataStream.readVarint();
+		toRead = (int)(value >> 1) ^ -(int)(value & 1);
+		return dataStream;
+	}
 	Cursor& idx = dataStream.getReadIndex();
 	char* buf = dataStream.getInputBuffer();
 	toRead = ((buf[idx++] & 0xFF) << 24)
@@ -133,6 +208,10 @@ DataStream& operator>>(DataStream& dataStream, int& toRead) {
 
 /* Writes an unsigned short to the output stream. */
 DataStream& operator<<(DataStream& dataStream, const unsigned short& toWrite) {
+	if(dataStream.wireFormat == WIRE_FORMAT_COMPACT) {
+		dataStream.writeVarint(toWrite);
+		return dataStream;
+	}
 	Cursor& idx = dataStream.getWriteIndex();
 	char* buf = dataStream.getOutputBuffer();
 	buf[idx++] = (toWrite >> 8) & 0xFF;
@@ -142,6 +221,13 @@ DataStream& operator<<(DataStream& dataStream, const unsigned short& toWrite) {
 
 /* Reads an unsigned short from the input stream. */
 DataStream& operator>>(DataStream& dataStream, unsigned short& toRead) {
+	if(dataStream.wireFormat == WIRE_FORMAT_COMPACT) {
+		unsigned int value = dataStream.readVarint();
+		if(value > 0xFFFF)
+			throw exception("Short out of range");
+		toRead = (unsigned short)value;
+		return dataStream;
+	}
 	Cursor& idx = dataStream.getReadIndex();
 	char* buf = dataStream.getInputBuffer();
 	toRead = ((buf[idx++] & 0xFF) << 8)
@@ -151,7 +237,7 @@ DataStream& operator>>(DataStream& dataStream, unsigned short& toRead) {
 
 /* First writes the size of the string to the output stream and then the string itself. */
 DataStream& operator<<(DataStream& dataStream, const string& toWrite) {
-	dataStream << (unsigned short)toWrite.size();
+	dataStream << (unsigned short)toWrite.size(); //A varint in the compact format.
 	Cursor& idx = dataStream.getWriteIndex();
 	int curIdx = idx.getPosition();
 	idx += (int)toWrite.size();
@@ -183,6 +269,14 @@ DataStream& operator>>(DataStream& dataStream, string& toRead) {
 DataStream& operator>>(DataStream& dataStream, bool& toRead) {
 	Cursor& idx = dataStream.getReadIndex();
 	char* buf = dataStream.getInputBuffer();
+	if(dataStream.wireFormat == WIRE_FORMAT_COMPACT) {
+		if(dataStream.readFlagBits == FLAG_BITS) {
+			dataStream.readFlagPosition = idx++;
+			dataStream.readFlagBits = 0;
+		}
+		toRead = ((buf[dataStream.readFlagPosition] >> dataStream.readFlagBits++) & 1) == 1;
+		return dataStream;
+	}
 	toRead = buf[idx++] == 1;
 	return dataStream;
 }
@@ -192,6 +286,17 @@ DataStream& operator>>(DataStream& dataStream, bool& toRead) {
 DataStream& operator<<(DataStream& dataStream, const bool& toWrite) {
 	Cursor& idx = dataStream.getWriteIndex();
 	char* buf = dataStream.getOutputBuffer();
+	if(dataStream.wireFormat == WIRE_FORMAT_COMPACT) {
+		if(dataStream.writeFlagBits == FLAG_BITS) {
+			dataStream.writeFlagPosition = idx++;
+			buf[dataStream.writeFlagPosition] = 0;
+			dataStream.writeFlagBits = 0;
+		}
+		if(toWrite)
+			buf[dataStream.writeFlagPosition] |= (char)(1 << dataStream.writeFlagBits);
+		dataStream.writeFlagBits++;
+		return dataStream;
+	}
 	buf[idx++] = toWrite ? 1 : 0;
 	return dataStream;
 }
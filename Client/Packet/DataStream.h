@@ -28,12 +28,23 @@ public:
 	unsigned short getSize();
 	Cursor& getReadIndex();
 	Cursor& getWriteIndex();
+	void setWireFormat(unsigned short wireFormat);
+	unsigned short getWireFormat();
+	void writePacketId(unsigned short packetId);
+	int readPacketId();
 private:
 	const unsigned short size;
 	Cursor readIndex;
 	Cursor writeIndex;
 	char* inBuf;
 	char* outBuf;
+	unsigned short wireFormat;
+	unsigned short writeFlagPosition;
+	unsigned short writeFlagBits;
+	unsigned short readFlagPosition;
+	unsigned short readFlagBits;
+	void writeVarint(unsigned int value);
+	unsigned int readVarint();
 	/* Writing Variables*/
 	friend DataStream& operator<<(DataStream& dataStream, const char* toWrite);
 	friend DataStream& operator<<(DataStream& dataStream, const std::string& toWrite);
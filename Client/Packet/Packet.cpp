@@ -2,7 +2,7 @@
 using namespace std;
 
 Packet::Packet(DataStream* const stream, unsigned short packetId) : stream(stream), packetId(packetId), currentIndex(0) {
-	*this << (int)getId();
+	stream->writePacketId(packetId);
 }
 
 Packet::~Packet() {}
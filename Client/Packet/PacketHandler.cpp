@@ -10,6 +10,7 @@ PacketHandler::PacketHandler(ChatClient* const clientInstance, SOCKET socket) :
 	socket(socket),
 	connected(true),
 	constructingPacket(nullptr),
+	offlineMessagesReceived(0),
 	peeker(new DataStream(4)),
 	stream(new DataStream(BUFFER_LENGTH)) {}
 
@@ -55,7 +56,7 @@ void PacketHandler::readLoop() {
 					break;
 				if(totalRead == totalSize) {
 					while(connected && totalRead > stream->getReadIndex().getPosition()) { //Process packets until all packets in the chunk of data are consumed.
-						*stream >> packetId;
+						packetId = stream->readPacketId();
 						switch(packetId) {
 							case HANDSHAKE_PACKET_ID:
 							{
@@ -65,7 +66,11 @@ void PacketHandler::readLoop() {
 									throw PacketException("Server had invalid version code: " + versionCode);
 								}
 								//cout << endl << "Received handshake version: " << versionCode << endl; //TODO: REMOVE
-								user->doCredentials();
+								mtx.lock(); //The handshake is in the legacy format, everything after it in the compact format.
+								stream->setWireFormat(WIRE_FORMAT_COMPACT);
+								mtx.unlock();
+								if(!user->resumeSession())
+									user->doCredentials();
 								break;
 							}
 							case AUTHENTICATION_PACKET_ID:
@@ -78,9 +83,18 @@ void PacketHandler::readLoop() {
 										user->doCredentials(true);
 										break;
 									case AUTHENTICATION_NAME_IN_USE:
+										if(user->isResuming()) { //The server hasn't noticed our old connection closing yet, try again shortly.
+											user->disconnect();
+											return;
+										}
 										user->getConsoleRenderer()->pushBodyMessage("That username is already in use.", ERROR_COLOR);
 										user->doCredentials();
 										break;
+									case AUTHENTICATION_RESUME_REJECTED:
+										user->getConsoleRenderer()->pushBodyMessage("Your session has expired, please restart the client to log in again.", ERROR_COLOR);
+										user->setResumeToken("");
+										user->disconnect();
+										return;
 									case AUTHENTICATION_INVALID_USERNAME:
 										user->getConsoleRenderer()->pushBodyMessage("Please enter a valid username using letters (a-z) and numbers only (0-9).", ERROR_COLOR);
 										user->doCredentials();
@@ -91,6 +105,7 @@ void PacketHandler::readLoop() {
 									default:
 									case AUTHENTICATION_FAILURE:
 										user->getConsoleRenderer()->pushBodyMessage("The server could not process your authentication.", ERROR_COLOR);
+										user->setResumeToken("");
 										user->disconnect();
 										return;
 								}
@@ -121,6 +136,37 @@ void PacketHandler::readLoop() {
 									"<" + to_string(userChatColor) + ">" + message);
 								break;
 							}
+							case OFFLINE_MESSAGES_PACKET_ID:
+							{
+								unsigned short count = 0;
+								bool last = false;
+								*stream >> count;
+								for(unsigned short i = 0; i < count; i++) {
+									string messageFrom;
+									unsigned short usernameColor;
+									unsigned short userChatColor;
+									string message;
+									*stream >> messageFrom;
+									*stream >> usernameColor;
+									*stream >> userChatColor;
+									*stream >> message;
+									user->getConsoleRenderer()->pushBodyMessage(
+										"<" + to_string(FRIEND_COLOR) + ">[OFFLINE] " +
+										"<" + to_string((user->isFriend(messageFrom) ? FRIEND_COLOR : usernameColor)) + ">" +
+										messageFrom +
+										"<" + to_string(DEFAULT_COLOR) + ">: " +
+										"<" + to_string(userChatColor) + ">" + message);
+								}
+								*stream >> last;
+								offlineMessagesReceived += count;
+								if(last) { //Let the server know every batch arrived so it can drop them from the spool.
+									Packet* p = constructPacket(OFFLINE_MESSAGES_ACK_PACKET_ID);
+									*p << (int)offlineMessagesReceived;
+									finializePacket(p, true);
+									offlineMessagesReceived = 0;
+								}
+								break;
+							}
 							case ATTEMPT_JOIN_ROOM_PACKET_ID:
 							{
 								unsigned short joinRoomStatusCode = 0;
@@ -135,51 +181,92 @@ void PacketHandler::readLoop() {
 							case LEAVE_ROOM_PACKET_ID:
 							{
 								user->setInRoom(false);
+								user->drawRoomList();
 								break;
 							}
 							case ROOM_STATUS_UPDATE_PACKET_ID:
 							{
+								int version = 0;
 								unsigned short roomCount = 0;
+								*stream >> version;
 								*stream >> roomCount;
-								string* roomNames = new string[roomCount];
-								unsigned short* roomColors = new unsigned short[roomCount];
-								//cout << "Room list update (" << roomCount << "):";
+								vector<RoomEntry> roomList(roomCount);
 								for(unsigned short i = 0; i < roomCount; i++) {
-									string roomName = "";
-									*stream >> roomName;
-									//cout << " " << roomName;
-									roomNames[i] = roomName;
-									roomColors[i] = DEFAULT_COLOR;
+									*stream >> roomList[i].name;
+									*stream >> roomList[i].userCount;
+								}
+								user->setRoomList(version, roomList);
+								break;
+							}
+							case ROOM_LIST_DELTA_PACKET_ID:
+							{
+								int version = 0;
+								unsigned short deltaCount = 0;
+								*stream >> version;
+								*stream >> deltaCount;
+								vector<unsigned short> types(deltaCount);
+								vector<RoomEntry> entries(deltaCount);
+								for(unsigned short i = 0; i < deltaCount; i++) {
+									*stream >> types[i];
+									*stream >> entries[i].name;
+									*stream >> entries[i].userCount;
+								}
+								if(!user->applyRoomListDeltas(version, types, entries)) { //Missed a version, ask for the whole list again.
+									Packet* p = constructPacket(ROOM_LIST_RESYNC_PACKET_ID);
+									finializePacket(p, true);
 								}
-								if(!user->isInRoom())
-									user->getConsoleRenderer()->updateTopRight(roomNames, roomColors, roomCount);
-								delete[] roomNames;
-								delete[] roomColors;
-								//cout << endl;
 								break;
 							}
 							case UPDATE_ROOM_LIST_PACKET_ID:
 							{
-
+								int version = 0;
 								unsigned short userCount = 0;
+								*stream >> version;
 								*stream >> userCount;
-								string* userRoomList = new string[userCount];
-								unsigned short* userRoomColors = new unsigned short[userCount];
-								//cout << "User list update (" << userCount << "):";
+								vector<MemberEntry> memberList(userCount);
 								for(unsigned short i = 0; i < userCount; i++) {
-									unsigned short usernameColor = 0;
-									string userName = "";
-									*stream >> usernameColor;
-									*stream >> userName;
-									//cout << " " << userName;
-									userRoomList[i] = userName;
-									userRoomColors[i] = usernameColor;
+									*stream >> memberList[i].color;
+									*stream >> memberList[i].name;
+								}
+								user->setMemberList(version, memberList);
+								break;
+							}
+							case ROOM_MEMBER_DELTA_PACKET_ID:
+							{
+								int version = 0;
+								unsigned short type = 0;
+								MemberEntry member;
+								*stream >> version;
+								*stream >> type;
+								*stream >> member.color;
+								*stream >> member.name;
+								if(!user->applyMemberDelta(version, type, member)) { //Missed a version, ask for the whole list again.
+									Packet* p = constructPacket(ROOM_MEMBER_RESYNC_PACKET_ID);
+									finializePacket(p, true);
+								}
+								break;
+							}
+							case ROOM_MEMBER_PAGE_PACKET_ID:
+							{
+								unsigned short memberCount = 0;
+								unsigned short page = 0;
+								unsigned short pageCount = 0;
+								*stream >> memberCount;
+								*stream >> page;
+								*stream >> pageCount;
+								vector<MemberEntry> memberList(pageCount);
+								for(unsigned short i = 0; i < pageCount; i++) {
+									*stream >> memberList[i].color;
+									*stream >> memberList[i].name;
 								}
-								if(user->isInRoom())
-									user->getConsoleRenderer()->updateTopRight(userRoomList, userRoomColors, userCount);
-								delete[] userRoomList;
-								delete[] userRoomColors;
-								//cout << endl;
+								user->setMemberPage(memberCount, page, memberList);
+								break;
+							}
+							case ROOM_MEMBER_COUNT_PACKET_ID:
+							{
+								unsigned short memberCount = 0;
+								*stream >> memberCount;
+								user->setMemberCount(memberCount);
 								break;
 							}
 							case SERVER_MESSAGE_PACKET_ID:
@@ -235,6 +322,40 @@ void PacketHandler::readLoop() {
 								}
 								break;
 							}
+							case FRIEND_PRESENCE_BATCH_PACKET_ID:
+							{
+								unsigned short changeCount = 0;
+								*stream >> changeCount;
+								vector<string> loggedOn;
+								vector<string> loggedOff;
+								for(unsigned short c = 0; c < changeCount; c++) {
+									string name = "";
+									bool isOnline = false;
+									*stream >> name;
+									*stream >> isOnline;
+									(isOnline ? loggedOn : loggedOff).push_back(name);
+									transform(name.begin(), name.end(), name.begin(), ::tolower);
+									for(unsigned short i = 0; i < user->getFriendsListSize(); i++) {
+										if(user->getFriendsList()[i] != nullptr && user->getFriendsList()[i]->getLowercaseName() == name) {
+											user->getFriendsList()[i]->setOnline(isOnline);
+											break;
+										}
+									}
+								}
+								user->getConsoleRenderer()->updateBottomRight(user->getFriendsList(), user->getFriendsListSize());
+								if(!loggedOn.empty())
+									user->getConsoleRenderer()->pushBodyMessage("<" + to_string(FRIEND_COLOR) + ">" + summarizeNames(loggedOn) + "<" + to_string(DEFAULT_COLOR) + "> " + (loggedOn.size() == 1 ? "has" : "have") + " just logged on.");
+								if(!loggedOff.empty())
+									user->getConsoleRenderer()->pushBodyMessage("<" + to_string(FRIEND_OFFLINE_COLOR) + ">" + summarizeNames(loggedOff) + "<" + to_string(DEFAULT_COLOR) + "> " + (loggedOff.size() == 1 ? "has" : "have") + " just logged off.");
+								break;
+							}
+							case RESUME_TOKEN_PACKET_ID:
+							{
+								string resumeToken = "";
+								*stream >> resumeToken;
+								user->setResumeToken(resumeToken);
+								break;
+							}
 							case FRIENDS_LIST_PACKET_ID:
 							{
 								for(unsigned short i = 0; i < user->getFriendsListSize(); i++) {
@@ -284,6 +405,17 @@ void PacketHandler::readLoop() {
 	user->disconnect();
 }
 
+/* Joins names for a status line, such as "alice, bob and 3 others". */
+string PacketHandler::summarizeNames(const vector<string>& names) {
+	if(names.size() == 1)
+		return names[0];
+	if(names.size() == 2)
+		return names[0] + " and " + names[1];
+	if(names.size() == 3)
+		return names[0] + ", " + names[1] + " and " + names[2];
+	return names[0] + ", " + names[1] + " and " + to_string(names.size() - 2) + " others";
+}
+
 /* Makes a new packet and returns it for modification.
 	This also locks a mutex to prevent sending data in flush() until it's finished.
 */
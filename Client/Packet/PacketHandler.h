@@ -4,6 +4,8 @@
 #include "Packet.h"
 #include <winsock2.h>
 #include <mutex>
+#include <vector>
+#include <string>
 class ChatClient;
 
 class PacketHandler {
@@ -16,6 +18,7 @@ public:
 	void finializePacket(Packet* const packet, bool _flush = false);
 	void flush(bool self = false);
 private:
+	static std::string summarizeNames(const std::vector<std::string>& names);
 	SOCKET socket;
 	ChatClient* const user;
 	bool connected;
@@ -23,5 +26,6 @@ private:
 	DataStream* peeker;
 	std::mutex mtx;
 	Packet* constructingPacket;
+	unsigned int offlineMessagesReceived;
 };
 #endif //PACKET_HANDLER_H_
\ No newline at end of file
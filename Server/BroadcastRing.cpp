@@ -0,0 +1,39 @@
+#include "BroadcastRing.h"
+using namespace std;
+
+BroadcastRing::BroadcastRing() : head(0) {}
+
+/* Stores the event in the next slot, overwriting the oldest event once the ring has wrapped. */
+void BroadcastRing::publish(shared_ptr<const Frame> frame, shared_ptr<const Frame> senderFrame, unsigned short senderId) {
+	lock_guard<mutex> lock(mtx);
+	RingEvent& event = events[head % ROOM_RING_SIZE];
+	event.frame = frame;
+	event.senderFrame = senderFrame;
+	event.senderId = senderId;
+	head++;
+}
+
+/* Returns the sequence number the next published event will get, a new member starts reading from here. */
+unsigned long long BroadcastRing::getHead() {
+	lock_guard<mutex> lock(mtx);
+	return head;
+}
+
+/* Copies up to maxEvents events from the cursor towards the head into out and moves the cursor past them.
+	A cursor more than maxBacklog events behind (never more than the ring holds) is first moved up to that point.
+	Returns how many events were skipped that way.
+*/
+unsigned long long BroadcastRing::drain(unsigned long long& cursor, vector<RingEvent>& out, unsigned short maxEvents, unsigned short maxBacklog) {
+	lock_guard<mutex> lock(mtx);
+	unsigned long long missed = 0;
+	if(maxBacklog > ROOM_RING_SIZE)
+		maxBacklog = ROOM_RING_SIZE;
+	if(head - cursor > maxBacklog) {
+		missed = head - cursor - maxBacklog;
+		cursor = head - maxBacklog;
+	}
+	for(unsigned short i = 0; i < maxEvents && cursor < head; i++, cursor++) {
+		out.push_back(events[cursor % ROOM_RING_SIZE]);
+	}
+	return missed;
+}
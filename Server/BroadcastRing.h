@@ -0,0 +1,33 @@
+#ifndef BROADCAST_RING_H_
+#define BROADCAST_RING_H_
+#include "Constants.h"
+#include "Packet/Frame.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#define RING_NO_SENDER 0xFFFF
+
+/* A single encoded room event. The sender is given senderFrame, everyone else is given frame. */
+struct RingEvent {
+	std::shared_ptr<const Frame> frame;
+	std::shared_ptr<const Frame> senderFrame;
+	unsigned short senderId;
+};
+
+/* A fixed size ring of encoded events shared by every member of a room.
+	Publishing only stores the event in the next slot, members keep their own cursor (a sequence number) and copy events out when their writer runs.
+	A member that falls more than ROOM_RING_SIZE events behind has lost the events in between.
+*/
+class BroadcastRing {
+public:
+	BroadcastRing();
+	void publish(std::shared_ptr<const Frame> frame, std::shared_ptr<const Frame> senderFrame, unsigned short senderId = RING_NO_SENDER);
+	unsigned long long getHead();
+	unsigned long long drain(unsigned long long& cursor, std::vector<RingEvent>& out, unsigned short maxEvents = ROOM_RING_SIZE, unsigned short maxBacklog = ROOM_RING_SIZE);
+private:
+	RingEvent events[ROOM_RING_SIZE];
+	unsigned long long head;
+	std::mutex mtx;
+};
+#endif //BROADCAST_RING_H_
@@ -2,11 +2,26 @@
 #define CONSTANTS_H_
 #define MAX_USERS 100
 #define MAX_ROOMS 10
-#define MAX_ROOM_USERS 10
+#define MAX_ROOM_USERS MAX_USERS
+#define ROOM_LARGE_MODE_THRESHOLD 20
+#define ROOM_MEMBER_PAGE_SIZE 9
 #define MAX_FRIENDS 10
 #define DESIRED_WINSOCK_VERSION MAKEWORD(2, 2)
 #define BUFFER_LENGTH 4096
-#define PACKET_COUNT 10
+#define ROOM_LIST_COALESCE_MS 100
+#define ROOM_STATUS_AGGREGATION_MS 2000
+#define PRESENCE_DEBOUNCE_MS 3000
+#define ROOM_RING_SIZE 256
+#define LANE_CONTROL_WEIGHT 8
+#define LANE_PRIVATE_WEIGHT 4
+#define LANE_CHAT_WEIGHT 2
+#define OUTBOUND_PASS_BUDGET (BUFFER_LENGTH * 4)
+#define CHAT_LANE_MAX_BACKLOG (ROOM_RING_SIZE / 2)
+#define LANE_CONTROL_MAX_FRAMES 1024
+#define LANE_PRIVATE_MAX_FRAMES 256
+#define ROOM_SCROLLBACK_COUNT 50
+#define ROOM_SCROLLBACK_BYTES (BUFFER_LENGTH * 4)
+#define SCROLLBACK_TOTAL_BYTES (ROOM_SCROLLBACK_BYTES * MAX_ROOMS / 2)
 #define HANDSHAKE_PACKET_ID 0
 #define AUTHENTICATION_PACKET_ID 1
 #define AUTHENTICATION_INVALID_PASSWORD 0
@@ -14,6 +29,7 @@
 #define AUTHENTICATION_SUCCESS 2
 #define AUTHENTICATION_FAILURE 3
 #define AUTHENTICATION_INVALID_USERNAME 4
+#define AUTHENTICATION_RESUME_REJECTED 5
 #define MESSAGE_PACKET_ID 3
 #define ATTEMPT_JOIN_ROOM_PACKET_ID 4
 #define ATTEMPT_JOIN_ROOM_SUCCESS 0
@@ -26,9 +42,58 @@
 #define REMOVE_FRIEND_PACKET_ID 10
 #define FRIEND_STATUS_PACKET_ID 11
 #define FRIENDS_LIST_PACKET_ID 12
+#define ROOM_LIST_DELTA_PACKET_ID 13
+#define ROOM_LIST_DELTA_ADDED 0
+#define ROOM_LIST_DELTA_REMOVED 1
+#define ROOM_LIST_DELTA_COUNT 2
+#define ROOM_LIST_RESYNC_PACKET_ID 14
+#define ROOM_MEMBER_DELTA_PACKET_ID 15
+#define ROOM_MEMBER_ADDED 0
+#define ROOM_MEMBER_REMOVED 1
+#define ROOM_MEMBER_RECOLORED 2
+#define ROOM_MEMBER_RESYNC_PACKET_ID 16
+#define ROOM_MEMBER_COUNT_PACKET_ID 17
+#define ROOM_MEMBER_PAGE_PACKET_ID 18
+#define FRIEND_PRESENCE_BATCH_PACKET_ID 19
+#define OFFLINE_MESSAGES_PACKET_ID 20
+#define OFFLINE_MESSAGES_ACK_PACKET_ID 21
+#define RESUME_PACKET_ID 22
+#define RESUME_TOKEN_PACKET_ID 23
 
 #define LOG_DIRECTORY "./"
 #define SAVE_DIRECTORY "./users/"
+#define USER_FILE_VERSION 2
+#define PERSIST_INTERVAL_MS 500
+#define USER_STORE_FILE "users.log"
+#define USER_STORE_INDEX_FILE "users.idx"
+#define STORE_COMPACT_MIN_BYTES (1024 * 1024)
+#define REGISTRY_BLOOM_BITS (1 << 22)
+#define REGISTRY_BLOOM_HASHES 4
+#define PROFILE_CACHE_SIZE 1024
+#define PROFILE_STATS_LOG_MS 60000
+#define SPOOL_DIRECTORY "./users/spool/"
+#define SPOOL_SEGMENT_BYTES (64 * 1024)
+#define SPOOL_FLUSH_MS 250
+#define SPOOL_PACKET_BYTES 3072
+#define SPOOL_MAX_MESSAGES_PER_USER 500
+#define SPOOL_MAX_MESSAGE_LENGTH (BUFFER_LENGTH / 2)
+#define SPOOL_QUEUED 0
+#define SPOOL_NO_SUCH_USER 1
+#define SPOOL_FULL 2
+#define SPOOL_TOO_LONG 3
+#define ARCHIVE_DIRECTORY "./archive/"
+#define ARCHIVE_SEGMENT_SECONDS 3600
+#define ARCHIVE_FLUSH_MS 500
+#define ARCHIVE_SEARCH_RESULTS 10
+#define ARCHIVE_MAX_TOKEN_LENGTH 32
+#define EXPORT_DIRECTORY "./export/"
+#define EXPORT_BLOCK_ROWS 4096
+#define EXPORT_BLOCK_MAX_MS 60000
+#define EXPORT_FLUSH_MS 1000
+#define SNAPSHOT_FILE "sessions.snap"
+#define SNAPSHOT_INTERVAL_MS 1000
+#define RESUME_WINDOW_SECONDS 120
+#define RESUME_TOKEN_BYTES 16
 #define LOAD_SUCCESS 0
 #define LOAD_FAILURE 1
 #define LOAD_NEW_USER 2
@@ -39,5 +104,9 @@
 #define DEFAULT_COLOR 15
 #define DEFAULT_CHAT_COLOR 11
 
-#define VERSION_CODE "Drocsid 0.4"
+#define VERSION_CODE "Drocsid 0.6"
+#define LEGACY_VERSION_CODE "Drocsid 0.5"
+#define WIRE_FORMAT_LEGACY 0
+#define WIRE_FORMAT_COMPACT 1
+#define WIRE_FORMAT_COUNT 2
 #endif //CONSTANTS_H_
\ No newline at end of file
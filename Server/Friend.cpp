@@ -1,13 +1,10 @@
 #include "Friend.h"
 #include "User.h"
-#include <algorithm>
 using namespace std;
 
-Friend::Friend(User* const activeUser, string name) :
+Friend::Friend(User* const activeUser, const Symbol& name) :
 	activeUser(activeUser),
-	name(name),
-	lowercaseName(name) {
-	transform(lowercaseName.begin(), lowercaseName.end(), lowercaseName.begin(), ::tolower);
+	name(name) {
 }
 
 User* const Friend::getActiveUser() {
@@ -18,14 +15,24 @@ void Friend::setActiveUser(User* const activeUser) {
 	this->activeUser = activeUser;
 }
 
-string Friend::getName() {
-	return name;
+const string& Friend::getName() const {
+	return name.name;
 }
 
-string Friend::getLowercaseName() {
-	return lowercaseName;
+const string& Friend::getLowercaseName() const {
+	return name.folded;
+}
+
+/* Returns the interned id of the friend's name. */
+SymbolId Friend::getNameId() const {
+	return name.id;
+}
+
+/* Returns the interned id of the friend's lowercase name, used for case insensitive comparisons. */
+SymbolId Friend::getFoldedId() const {
+	return name.foldedId;
 }
 
 bool Friend::isOnline() {
 	return activeUser != nullptr && activeUser->getPacketHandler()->isConnected();
-}
\ No newline at end of file
+}
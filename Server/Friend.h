@@ -1,19 +1,21 @@
 #ifndef FRIEND_H_
 #define FRIEND_H_
 #include <string>
+#include "SymbolTable.h"
 class User;
 class Friend {
 public:
-	Friend(User* const activeUser, std::string name);
+	Friend(User* const activeUser, const Symbol& name);
 	User* const getActiveUser();
 	void setActiveUser(User* const activeUser);
-	std::string getName();
-	std::string getLowercaseName();
+	const std::string& getName() const;
+	const std::string& getLowercaseName() const;
+	SymbolId getNameId() const;
+	SymbolId getFoldedId() const;
 	bool isOnline();
 private:
 	User* activeUser;
-	std::string name;
-	std::string lowercaseName;
+	const Symbol& name;
 };
 
-#endif //FRIEND_H_
\ No newline at end of file
+#endif //FRIEND_H_
@@ -0,0 +1,21 @@
+#ifndef FRAME_H_
+#define FRAME_H_
+#include "../Constants.h"
+#include <string>
+
+/* A packet already encoded for sending to many users, once in each wire format (see FrameCache::encode()).
+	Every format is always filled in, a frame kept in a room's ring or scrollback can reach a client of either format that connects later.
+*/
+struct Frame {
+	std::string encodings[WIRE_FORMAT_COUNT];
+
+	/* Returns the bytes held across every encoding. */
+	size_t size() const {
+		size_t total = 0;
+		for(unsigned short i = 0; i < WIRE_FORMAT_COUNT; i++) {
+			total += encodings[i].size();
+		}
+		return total;
+	}
+};
+#endif //FRAME_H_
@@ -0,0 +1,94 @@
+#include "FrameCache.h"
+#include "DataStream.h"
+#include "../Server.h"
+using namespace std;
+
+FrameCache::FrameCache(Server* const server) : server(server) {}
+
+/* Returns the encoded frame, building it first if it isn't cached. */
+shared_ptr<const Frame> FrameCache::get(unsigned short frameId) {
+	lock_guard<mutex> lock(mtx);
+	if(frames[frameId] == nullptr)
+		frames[frameId] = build(frameId);
+	return frames[frameId];
+}
+
+/* Drops the frame so it is rebuilt on its next use. Anyone still holding the old frame can keep sending it. */
+void FrameCache::invalidate(unsigned short frameId) {
+	lock_guard<mutex> lock(mtx);
+	frames[frameId] = nullptr;
+}
+
+/* Encodes a single packet into its wire bytes in every wire format, the writer fills in the payload and is run once per format.
+	Every message sent to a room passes through here, so each thread encodes into its own stream that is kept between calls rather than allocating and clearing a new one.
+	The writer must not encode another frame itself.
+*/
+shared_ptr<const Frame> FrameCache::encode(unsigned short packetId, const function<void(Packet&)>& writer) {
+	static thread_local DataStream stream(BUFFER_LENGTH);
+	shared_ptr<Frame> frame = make_shared<Frame>();
+	for(unsigned short wireFormat = 0; wireFormat < WIRE_FORMAT_COUNT; wireFormat++) {
+		stream.getWriteIndex().reset();
+		stream.setWireFormat(wireFormat);
+		Packet packet(&stream, packetId);
+		writer(packet);
+		frame->encodings[wireFormat].assign(stream.getOutputBuffer(), stream.getWriteIndex().getPosition());
+	}
+	return frame;
+}
+
+/* Encodes a run of server messages back to back, the same as multiple User::sendServerMessage() calls would. */
+shared_ptr<const Frame> FrameCache::encodeServerMessages(const vector<string>& messages, unsigned short messageColor) {
+	shared_ptr<Frame> frame = make_shared<Frame>();
+	for(const string& message : messages) {
+		shared_ptr<const Frame> encoded = encode(SERVER_MESSAGE_PACKET_ID, [&](Packet& p) {
+			p << "<" + to_string(messageColor) + ">" + message;
+		});
+		for(unsigned short wireFormat = 0; wireFormat < WIRE_FORMAT_COUNT; wireFormat++) {
+			frame->encodings[wireFormat] += encoded->encodings[wireFormat];
+		}
+	}
+	return frame;
+}
+
+/* Builds the frame for the id. */
+shared_ptr<const Frame> FrameCache::build(unsigned short frameId) {
+	switch(frameId) {
+		case FRAME_WELCOME:
+			return encodeServerMessages({
+				"Welcome to <11>Drocsid!",
+				"Type /joinroom [name] to join/create a room.",
+				"Type /help for more commands."
+			}, DEFAULT_COLOR);
+		case FRAME_HELP:
+			return encodeServerMessages({
+				"/joinroom [room name]",
+				"/leaveroom",
+				"/members [page number]",
+				"/friendsinroom",
+				"/addfriend [username]",
+				"/removefriend [username]",
+				"/friendslist",
+				"/pm [username] [message]",
+				"/reply [message]",
+				"/search [room name] [words]",
+				"/settextcolor [color number]",
+				"/setnamecolor [color number]",
+				"/colors"
+			}, DEFAULT_COLOR);
+		case FRAME_COLORS:
+		{
+			string output = "";
+			for(unsigned short i = 0; i < 255; i++) {
+				string num = to_string(i);
+				output += "<" + num + ">" + num + " ";
+			}
+			return encodeServerMessages({output}, DEFAULT_COLOR);
+		}
+		case FRAME_ROOM_LIST:
+			return encode(ROOM_STATUS_UPDATE_PACKET_ID, [this](Packet& p) {
+				server->writeRoomList(p);
+			});
+		default:
+			throw runtime_error("Unknown frame id " + to_string(frameId));
+	}
+}
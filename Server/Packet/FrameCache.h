@@ -0,0 +1,34 @@
+#ifndef FRAME_CACHE_H_
+#define FRAME_CACHE_H_
+#include "../Constants.h"
+#include "Packet.h"
+#include "Frame.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#define FRAME_WELCOME 0
+#define FRAME_HELP 1
+#define FRAME_COLORS 2
+#define FRAME_ROOM_LIST 3
+#define FRAME_COUNT 4
+class Server;
+
+/* Keeps server responses that rarely change already encoded, so sending them is a copy of bytes instead of rebuilding them for every request.
+	Frames are immutable once built and hold every wire format. invalidate() drops a frame so the next get() rebuilds it.
+*/
+class FrameCache {
+public:
+	FrameCache(Server* const server);
+	std::shared_ptr<const Frame> get(unsigned short frameId);
+	void invalidate(unsigned short frameId);
+	static std::shared_ptr<const Frame> encode(unsigned short packetId, const std::function<void(Packet&)>& writer);
+private:
+	std::shared_ptr<const Frame> build(unsigned short frameId);
+	static std::shared_ptr<const Frame> encodeServerMessages(const std::vector<std::string>& messages, unsigned short messageColor);
+	Server* const server;
+	std::shared_ptr<const Frame> frames[FRAME_COUNT];
+	std::mutex mtx;
+};
+#endif //FRAME_CACHE_H_
@@ -6,6 +6,7 @@
 
 class Packet {
 	friend class PacketHandler;
+	friend class FrameCache;
 public:
 	~Packet();
 	unsigned short getId() const;
@@ -5,6 +5,7 @@
 #include "../Room.h"
 #include "../Exception/PacketException.h"
 #include <chrono>
+#include <algorithm>
 
 using namespace std;
 
@@ -13,8 +14,12 @@ PacketHandler::PacketHandler(Server* const server, User* const user, SOCKET sock
 	user(user),
 	socket(socket),
 	connected(true),
+	wireFormat(WIRE_FORMAT_LEGACY),
 	constructingPacket(nullptr),
+	ringCursor(0),
+	deliveringOffline(false),
 	peeker(new DataStream(4)),
+	scratch(new DataStream(BUFFER_LENGTH)),
 	stream(new DataStream(BUFFER_LENGTH)) {}
 
 /* Continuously reads data from the socket.
@@ -59,18 +64,26 @@ void PacketHandler::readLoop() {
 					break;
 				if(totalRead == totalSize) {
 					while(connected && totalRead > stream->getReadIndex().getPosition()) { //Process packets until all packets in the chunk of data are consumed.
-						*stream >> packetId;
+						packetId = stream->readPacketId();
 						switch(packetId) {
 							case HANDSHAKE_PACKET_ID:
 							{
+								if(user->isVerified()) {
+									throw PacketAuthException("Verified user sent another handshake.");
+								}
 								string versionCode = "";
 								*stream >> versionCode;
-								if(versionCode != VERSION_CODE) {
+								if(versionCode != VERSION_CODE && versionCode != LEGACY_VERSION_CODE) {
 									throw PacketException("Client had invalid version code: " + versionCode);
 								}
-								Packet* p = constructPacket(HANDSHAKE_PACKET_ID);
-								*p << VERSION_CODE;
+								Packet* p = constructPacket(HANDSHAKE_PACKET_ID); //Always in the legacy format, the client switches once it has read the reply.
+								*p << versionCode;
 								finializePacket(p);
+								mtx.lock();
+								wireFormat = (versionCode == VERSION_CODE ? WIRE_FORMAT_COMPACT : WIRE_FORMAT_LEGACY);
+								stream->setWireFormat(wireFormat);
+								scratch->setWireFormat(wireFormat);
+								mtx.unlock();
 								user->setVerified(true);
 								break;
 							}
@@ -101,6 +114,7 @@ void PacketHandler::readLoop() {
 												returnCode = AUTHENTICATION_SUCCESS;
 												user->setUsername(username);
 												user->setPassword(password);
+												server->getUsernameRegistry().add(username);
 												server->log(user->getIp() + " has created a new username: " + user->getUsername());
 												break;
 											case LOAD_FAILURE:
@@ -113,15 +127,42 @@ void PacketHandler::readLoop() {
 								Packet* p = constructPacket(AUTHENTICATION_PACKET_ID);
 								*p << returnCode;
 								finializePacket(p);
+								if(returnCode == AUTHENTICATION_SUCCESS)
+									completeLogin(false);
+								break;
+							}
+							case RESUME_PACKET_ID:
+							{
+								if(!user->isVerified() || user->isAuthenticated()) {
+									throw PacketAuthException("Unverified or already authenticated user trying to resume a session.");
+								}
+								string username = "";
+								string token = "";
+								*stream >> username;
+								*stream >> token;
+								string roomName = "";
+								unsigned short returnCode = AUTHENTICATION_RESUME_REJECTED;
+								if(username.empty() || !server->isValidUsername(username)) {
+									server->log(user->getIp() + " tried to resume a session with invalid username: " + username);
+								} else if(server->getUserByName(username) != nullptr) { //Their old connection hasn't been noticed as closed yet, they'll retry.
+									returnCode = AUTHENTICATION_NAME_IN_USE;
+								} else if(!server->findResumableSession(token, username, roomName)) {
+									server->log(user->getIp() + " tried to resume a session for " + username + " that has expired or never existed.");
+								} else if(user->load(username) != LOAD_SUCCESS) {
+									returnCode = AUTHENTICATION_FAILURE;
+								} else if(!server->consumeResumableSession(token)) {
+									server->log(user->getIp() + " tried to resume a session for " + username + " that was resumed by another connection.");
+								} else {
+									returnCode = AUTHENTICATION_SUCCESS;
+									server->log(user->getUsername() + " has resumed their session from " + user->getIp() + ".");
+								}
+								Packet* p = constructPacket(AUTHENTICATION_PACKET_ID);
+								*p << returnCode;
+								finializePacket(p);
 								if(returnCode == AUTHENTICATION_SUCCESS) {
-									user->setAuthenticated(true);
-									user->sendServerMessage("Welcome to <11>Drocsid!", DEFAULT_COLOR);
-									user->sendServerMessage("Type /joinroom [name] to join/create a room.", DEFAULT_COLOR);
-									user->sendServerMessage("Type /help for more commands.", DEFAULT_COLOR);
-
-									server->handleFriendStatusUpdate(user);
-									user->sendFriendsList();
-									server->updateRoomList(user);
+									completeLogin(true);
+									if(!roomName.empty())
+										server->joinOrMakeRoom(user, roomName);
 								}
 								break;
 							}
@@ -139,6 +180,7 @@ void PacketHandler::readLoop() {
 										string command = (spacePos == string::npos ? message.substr(1, message.length()) : message.substr(1, spacePos - 1));
 										string arguments = (spacePos == string::npos ? "" : message.substr(spacePos + 1, message.length()));
 										server->log((user->getRoom() != nullptr ? "<" + user->getRoom()->getName() + "> " : "") + user->getUsername() + " used command: " + command + " with arguments: " + arguments);
+										server->getChatExporter().append(EXPORT_EVENT_COMMAND, user->getRoom() != nullptr ? user->getRoom()->getName() : "", user->getUsername(), message);
 										if(command == "joinroom") {
 											if(spacePos == string::npos) {
 												user->sendServerMessage("Invalid command arguments.");
@@ -151,27 +193,7 @@ void PacketHandler::readLoop() {
 											}
 											if(user->getRoom() != nullptr)
 												user->getRoom()->leaveRoom(user);
-											bool foundRoom = false;
-											Room** roomList = server->getRoomList();
-											for(unsigned short i = 0; i < MAX_ROOMS; i++) {
-												if(roomList[i] != nullptr) {
-													if(roomList[i]->getName() == arguments) {
-														roomList[i]->joinRoom(user);
-														foundRoom = true;
-														break;
-													}
-												}
-											}
-											if(!foundRoom) {
-												Room* newRoom = server->makeRoom(user, arguments);
-												if(newRoom == nullptr) {
-													Packet* p = user->getPacketHandler()->constructPacket(ATTEMPT_JOIN_ROOM_PACKET_ID);
-													*p << (unsigned short)ATTEMPT_JOIN_ROOM_FAILURE;
-													user->getPacketHandler()->finializePacket(p);
-												} else {
-													newRoom->joinRoom(user);
-												}
-											}
+											server->joinOrMakeRoom(user, arguments);
 										} else if(command == "leaveroom" || command == "leave") {
 											if(user->getRoom() != nullptr) {
 												user->getRoom()->leaveRoom(user);
@@ -232,7 +254,17 @@ void PacketHandler::readLoop() {
 											string actualMessage = arguments.substr(nextSpacePos + 1, arguments.length());
 											User* pmUser = server->getUserByName(pmName);
 											if(pmUser == nullptr) {
-												user->sendServerMessage("Could not find " + pmName + ".");
+												unsigned short spooled = server->spoolOfflineMessage(user, pmName, actualMessage);
+												if(spooled == SPOOL_QUEUED) {
+													user->setReplyUsername(server->getProperUsernameCase(pmName));
+													user->sendServerMessage(user->getReplyUsername() + " is offline, they'll get your message when they next log in.", DEFAULT_COLOR);
+												} else if(spooled == SPOOL_FULL) {
+													user->sendServerMessage(server->getProperUsernameCase(pmName) + " is offline and has too many messages waiting already.");
+												} else if(spooled == SPOOL_TOO_LONG) {
+													user->sendServerMessage(server->getProperUsernameCase(pmName) + " is offline and messages to offline users can be at most " + to_string(SPOOL_MAX_MESSAGE_LENGTH) + " characters.");
+												} else {
+													user->sendServerMessage("Could not find " + pmName + ".");
+												}
 												break;
 											} else if(pmUser == user) {
 												user->sendServerMessage("Surely you're not that lonely.");
@@ -254,7 +286,15 @@ void PacketHandler::readLoop() {
 											}
 											User* pmUser = server->getUserByName(user->getReplyUsername());
 											if(pmUser == nullptr) {
-												user->sendServerMessage(user->getReplyUsername() + " is no longer online.");
+												unsigned short spooled = server->spoolOfflineMessage(user, user->getReplyUsername(), arguments);
+												if(spooled == SPOOL_QUEUED)
+													user->sendServerMessage(user->getReplyUsername() + " is no longer online, they'll get your message when they next log in.", DEFAULT_COLOR);
+												else if(spooled == SPOOL_FULL)
+													user->sendServerMessage(user->getReplyUsername() + " is no longer online and has too many messages waiting already.");
+												else if(spooled == SPOOL_TOO_LONG)
+													user->sendServerMessage(user->getReplyUsername() + " is no longer online and messages to offline users can be at most " + to_string(SPOOL_MAX_MESSAGE_LENGTH) + " characters.");
+												else
+													user->sendServerMessage(user->getReplyUsername() + " is no longer online.");
 												break;
 											}
 											user->sendMessage(pmUser, arguments, false, true, true);
@@ -288,29 +328,61 @@ void PacketHandler::readLoop() {
 											} catch(invalid_argument&) {
 												user->sendServerMessage("Please type a proper integer for your desired color.");
 											}
-										} else if(command == "colors") {
-											string output = "";
-											for(byte i = 0; i < 255; i++) {
-												string num = to_string(i);
-												output += "<" + num + ">" + num + " ";
+										} else if(command == "members") {
+											if(user->getRoom() == nullptr) {
+												user->sendServerMessage("You're not in a room.");
+												break;
 											}
-											user->sendServerMessage(output, DEFAULT_COLOR);
+											unsigned short page = 1;
+											try {
+												if(!arguments.empty())
+													page = stoi(arguments);
+											} catch(invalid_argument&) {
+												user->sendServerMessage("Try as /members [page number]");
+												break;
+											}
+											user->getRoom()->sendMemberPage(user, page == 0 ? 0 : page - 1);
+										} else if(command == "friendsinroom") {
+											if(user->getRoom() == nullptr) {
+												user->sendServerMessage("You're not in a room.");
+												break;
+											}
+											user->getRoom()->sendFriendsInRoom(user);
+										} else if(command == "search") {
+											size_t nextSpacePos = arguments.find(' ');
+											if(nextSpacePos == string::npos || nextSpacePos == 0 || nextSpacePos + 1 >= arguments.length()) {
+												user->sendServerMessage("Invalid command arguments.");
+												user->sendServerMessage("Try as /search [room name] [words]");
+												break;
+											}
+											string roomName = arguments.substr(0, nextSpacePos);
+											string terms = arguments.substr(nextSpacePos + 1);
+											vector<ArchivedMessage> results;
+											if(!server->getChatArchive().search(roomName, terms, results)) {
+												user->sendServerMessage("Nothing has been said in " + roomName + ".");
+												break;
+											}
+											if(results.empty()) {
+												user->sendServerMessage("Nothing said in " + roomName + " matches " + terms + ".");
+											} else {
+												user->sendServerMessage("Latest messages in " + roomName + " matching " + terms + ":", DEFAULT_COLOR);
+												for(const ArchivedMessage& result : results) {
+													user->sendServerMessage("[" + ChatArchive::formatTime(result.time) + "] " + result.sender + ": " + result.text, DEFAULT_CHAT_COLOR);
+												}
+											}
+											if(!server->getChatArchive().isLoaded())
+												user->sendServerMessage("Older messages are still being loaded, try again shortly for a full search.", DEFAULT_COLOR);
+										} else if(command == "colors") {
+											sendFrame(server->getFrameCache().get(FRAME_COLORS));
 										} else if(command == "help" || command == "h" || command == "?" || command == "commands") {
-											user->sendServerMessage("/joinroom [room name]", DEFAULT_COLOR);
-											user->sendServerMessage("/leaveroom", DEFAULT_COLOR);
-											user->sendServerMessage("/addfriend [username]", DEFAULT_COLOR);
-											user->sendServerMessage("/removefriend [username]", DEFAULT_COLOR);
-											user->sendServerMessage("/friendslist", DEFAULT_COLOR);
-											user->sendServerMessage("/pm [username] [message]", DEFAULT_COLOR);
-											user->sendServerMessage("/reply [message]", DEFAULT_COLOR);
-											user->sendServerMessage("/settextcolor [color number]", DEFAULT_COLOR);
-											user->sendServerMessage("/setnamecolor [color number]", DEFAULT_COLOR);
-											user->sendServerMessage("/colors", DEFAULT_COLOR);
+											sendFrame(server->getFrameCache().get(FRAME_HELP));
 										} else {
 											validCommand = false;
 										}
 									} else if(user->getRoom() != nullptr) {
 										server->log("<" + user->getRoom()->getName() + "> " + user->getUsername() + ": " + message);
+										server->getChatArchive().append(user->getRoom()->getName(), user->getUsername(), message);
+										server->getChatExporter().append(EXPORT_EVENT_CHAT, user->getRoom()->getName(), user->getUsername(), message);
 										user->getRoom()->sendMessage(user, message);
 									} else {
 										validCommand = false;
@@ -322,6 +394,38 @@ void PacketHandler::readLoop() {
 								}
 								break;
 							}
+							case ROOM_LIST_RESYNC_PACKET_ID:
+							{
+								if(!user->isAuthenticated()) {
+									throw PacketAuthException("Unauthenticated user trying to resync the room list.");
+								}
+								server->updateRoomList(user);
+								break;
+							}
+							case OFFLINE_MESSAGES_ACK_PACKET_ID:
+							{
+								if(!user->isAuthenticated()) {
+									throw PacketAuthException("Unauthenticated user trying to acknowledge offline messages.");
+								}
+								int count = 0;
+								*stream >> count;
+								string lowercaseName = user->getUsername();
+								transform(lowercaseName.begin(), lowercaseName.end(), lowercaseName.begin(), ::tolower);
+								if(count <= 0 || !server->getOfflineSpool().acknowledge(lowercaseName, count))
+									server->log(user->getUsername() + " acknowledged " + to_string(count) + " offline messages that weren't delivered.");
+								break;
+							}
+							case ROOM_MEMBER_RESYNC_PACKET_ID:
+							{
+								if(!user->isAuthenticated()) {
+									throw PacketAuthException("Unauthenticated user trying to resync the room member list.");
+								}
+								if(user->getRoom() != nullptr && user->getRoom()->isLargeMode())
+									user->getRoom()->sendMemberPage(user, 0);
+								else if(user->getRoom() != nullptr)
+									user->getRoom()->updateRoomList(user);
+								break;
+							}
 							default:
 								throw PacketException("Invalid packet id " + to_string(packetId));
 						}
@@ -347,23 +451,57 @@ void PacketHandler::readLoop() {
 	user->disconnect();
 }
 
+/* Sends everything a user needs once they've logged in: their friends list, the room list, any private messages from while they were offline and a token to resume the session with.
+	Offline messages are only started here, the writer streams them onto the private lane as it drains (see pullOffline()).
+	The welcome message is left out when they're only resuming a session they had before losing their connection.
+*/
+void PacketHandler::completeLogin(bool resumed) {
+	user->setAuthenticated(true);
+	if(!resumed)
+		sendFrame(server->getFrameCache().get(FRAME_WELCOME));
+
+	server->handleFriendStatusUpdate(user);
+	user->sendFriendsList();
+	server->updateRoomList(user);
+
+	Packet* p = constructPacket(RESUME_TOKEN_PACKET_ID);
+	*p << server->issueResumeToken(user);
+	finializePacket(p);
+
+	const string& lowercaseName = user->getUsernameLowercase();
+	unsigned int offlineCount = server->getOfflineSpool().getPendingCount(lowercaseName);
+	if(offlineCount > 0) {
+		user->sendServerMessage("You have " + to_string(offlineCount) + (offlineCount == 1 ? " message" : " messages") + " from while you were offline:", DEFAULT_COLOR);
+		OfflineCursor cursor;
+		if(server->getOfflineSpool().beginDelivery(lowercaseName, cursor)) {
+			lock_guard<mutex> lock(mtx);
+			offlineCursor = cursor;
+			deliveringOffline = true;
+		}
+	}
+}
+
 /*
 	Contionuslly try to write information to the client.
 
 	A mutex is used here to ensure that we don't write while we're still in the process of constructing a packet. (Used in constructPacket()/finalizePacket())
-	If any data as accumulated in the buffer it will send that data.
+	If any data as accumulated in the outbound lanes it will send that data, see writeLanes() for the order the lanes are sent in.
 	(If a mutex wasn't used here we would have the possibility of sending a unfinished packet, which would break everything.)
 
 	A 50 millisecond sleep occurs each loop so that packets can be pooled together instead of only sending 1 at a time.
 	Additionally, if it were less than 50 milliseconds it would use more CPU.
+
+	If anything goes wrong writing (such as a frame too large to send) only this client's connection is closed, the read loop then fails and disconnects the user on its own thread.
 */
 void PacketHandler::writeLoop() {
-	while(connected) {
-		mtx.lock();
-		if(connected && stream->getWriteIndex().getPosition() > 0)
-			flush(true);
-		mtx.unlock();
-		this_thread::sleep_for(chrono::milliseconds(50)); // sleep snippet from https://stackoverflow.com/questions/4184468/sleep-for-milliseconds
+	try {
+		while(connected) {
+			flush();
+			this_thread::sleep_for(chrono::milliseconds(50)); // sleep snippet from https://stackoverflow.com/questions/4184468/sleep-for-milliseconds
+		}
+	} catch(exception& e) {
+		cerr << "Write loop error: " << e.what() << endl;
+		setConnected(false);
 	}
 }
 
@@ -372,31 +510,206 @@ void PacketHandler::writeLoop() {
 */
 Packet* const PacketHandler::constructPacket(unsigned short id) {
 	mtx.lock();
-	constructingPacket = new Packet(stream, id);
+	constructingPacket = new Packet(scratch, id);
 	return constructingPacket;
 }
 
-/* Finializes the packet by unlocking the mutex to let flush send the fully constructed packet. */
+/* Finializes the packet by moving it onto its outbound lane and unlocking the mutex.
+	Private messages go on the private lane, everything else sent directly to a user is a control packet. Room chat reaches the user through the room's ring instead.
+*/
 void PacketHandler::finializePacket(Packet* const packet, bool _flush) {
 	if(packet != constructingPacket)
 		throw runtime_error("Finialized packet wasn't the original.");
 	constructingPacket = nullptr;
+	enqueue(packet->getId() == MESSAGE_PACKET_ID ? LANE_PRIVATE : LANE_CONTROL, make_shared<const string>(scratch->getOutputBuffer(), scratch->getWriteIndex().getPosition()));
+	scratch->getWriteIndex().reset();
 	delete packet;
 	if(_flush)
 		flush(true);
 	mtx.unlock();
 }
 
-/* Sends the accumulated packet payload to the client.
+/* Queues an already encoded frame (see FrameCache) on a lane. The frame is shared, not copied, until it is written out. */
+void PacketHandler::sendFrame(shared_ptr<const Frame> frame, unsigned short lane) {
+	lock_guard<mutex> lock(mtx);
+	enqueue(lane, encodingFor(frame));
+}
+
+/* Queues a frame on a lane, must be called with the mutex locked.
+	Chat is kept bounded by pullChat() only taking more from the ring once the chat lane is empty, but the control and private lanes can't be skipped ahead like chat can.
+	A client that lets either of those back up past LANE_CONTROL_MAX_FRAMES or LANE_PRIVATE_MAX_FRAMES isn't going to catch up, so its connection is closed.
+	The read loop then fails and disconnects the user on its own thread.
+*/
+void PacketHandler::enqueue(unsigned short lane, shared_ptr<const string> frame) {
+	static const size_t limits[LANE_COUNT] = {LANE_CONTROL_MAX_FRAMES, LANE_PRIVATE_MAX_FRAMES, 0};
+	if(!connected)
+		return;
+	if(limits[lane] != 0 && lanes[lane].size() >= limits[lane]) {
+		server->log((user->getUsername().empty() ? user->getIp() : user->getUsername()) + " fell too far behind on outbound packets and is being disconnected.");
+		setConnected(false);
+		return;
+	}
+	lanes[lane].push_back(frame);
+}
+
+/* Returns the frame's encoding in this client's wire format, sharing ownership of the frame so nothing is copied. */
+shared_ptr<const string> PacketHandler::encodingFor(const shared_ptr<const Frame>& frame) const {
+	return shared_ptr<const string>(frame, &frame->encodings[wireFormat]);
+}
+
+/* Starts reading the room's broadcast ring from its current head, events are pulled onto the chat lane by the writer.
+	The room's scrollback goes on the chat lane first as one batch.
+*/
+void PacketHandler::subscribe(shared_ptr<BroadcastRing> ring, const vector<shared_ptr<const Frame>>& scrollback) {
+	lock_guard<mutex> lock(mtx);
+	this->ring = ring;
+	ringCursor = ring->getHead();
+	for(const shared_ptr<const Frame>& frame : scrollback) {
+		enqueue(LANE_CHAT, encodingFor(frame));
+	}
+}
+
+/* Stops reading the room's broadcast ring.
+	Room events published before the user left are drained from the ring first, and everything waiting on the chat lane is moved onto the control lane.
+	The leave packet is queued on the control lane afterwards, so the room's last messages still reach the user before it.
+*/
+void PacketHandler::unsubscribe() {
+	lock_guard<mutex> lock(mtx);
+	if(ring != nullptr)
+		pullChat(ROOM_RING_SIZE);
+	ring = nullptr;
+	while(!lanes[LANE_CHAT].empty()) {
+		enqueue(LANE_CONTROL, lanes[LANE_CHAT].front());
+		lanes[LANE_CHAT].pop_front();
+	}
+}
+
+/* Moves up to maxEvents room events this user hasn't seen yet onto the chat lane.
+	Chat is the lane that gets dropped under pressure: if the user is more than CHAT_LANE_MAX_BACKLOG events behind they skip ahead and are told how many messages they missed.
+	Must be called with the mutex locked.
+*/
+void PacketHandler::pullChat(unsigned short maxEvents) {
+	vector<RingEvent> events;
+	unsigned long long missed = ring->drain(ringCursor, events, maxEvents, CHAT_LANE_MAX_BACKLOG);
+	if(missed > 0) {
+		enqueue(LANE_CHAT, encodingFor(FrameCache::encode(SERVER_MESSAGE_PACKET_ID, [missed](Packet& p) {
+			p << "<" + to_string(DEFAULT_COLOR) + ">" + "You fell behind and missed " + to_string(missed) + " room messages.";
+		})));
+	}
+	for(RingEvent& event : events) {
+		enqueue(LANE_CHAT, encodingFor(event.senderId == user->getUserId() ? event.senderFrame : event.frame));
+	}
+}
+
+/* Reads the next segment of offline messages being delivered onto the private lane, in batches of about SPOOL_PACKET_BYTES with the very last batch flagged.
+	Only called once the private lane is empty, so a large spool is read a segment at a time as the client keeps up instead of all at once.
+	Must be called with the mutex locked.
+*/
+void PacketHandler::pullOffline() {
+	vector<OfflineMessage> messages;
+	bool last = server->getOfflineSpool().readNext(user->getUsernameLowercase(), offlineCursor, messages);
+	if(last)
+		deliveringOffline = false;
+	if(last && offlineCursor.delivered == 0)
+		return;
+	vector<OfflineMessage> batch;
+	size_t batchBytes = 0;
+	for(OfflineMessage& message : messages) {
+		if(message.message.length() > SPOOL_MAX_MESSAGE_LENGTH) //Spooled before the limit, cut down so it still fits in a packet.
+			message.message.resize(SPOOL_MAX_MESSAGE_LENGTH);
+		size_t messageBytes = message.from.size() + message.message.size() + 8;
+		if(!batch.empty() && batchBytes + messageBytes > SPOOL_PACKET_BYTES) {
+			queueOfflineBatch(batch, false);
+			batch.clear();
+			batchBytes = 0;
+		}
+		batch.push_back(message);
+		batchBytes += messageBytes;
+	}
+	if(last || !batch.empty())
+		queueOfflineBatch(batch, last);
+}
+
+/* Queues one OFFLINE_MESSAGES packet on the private lane, must be called with the mutex locked. */
+void PacketHandler::queueOfflineBatch(const vector<OfflineMessage>& messages, bool last) {
+	enqueue(LANE_PRIVATE, encodingFor(FrameCache::encode(OFFLINE_MESSAGES_PACKET_ID, [&](Packet& p) {
+		p << (unsigned short)messages.size();
+		for(const OfflineMessage& message : messages) {
+			p << message.from;
+			p << message.nameColor;
+			p << message.chatColor;
+			p << message.message;
+		}
+		p << last;
+	})));
+}
+
+/* Moves frames from the lanes into the outgoing stream, sending the stream whenever it fills up.
+	Each round takes up to the lane's weight in frames from every lane, highest priority first, so control packets never wait behind a chat backlog while chat still gets its share.
+	A pass stops after OUTBOUND_PASS_BUDGET bytes so the mutex isn't held for too long, whatever is left goes out on the next pass.
+	Must be called with the mutex locked.
+*/
+void PacketHandler::writeLanes() {
+	static const unsigned short weights[LANE_COUNT] = {LANE_CONTROL_WEIGHT, LANE_PRIVATE_WEIGHT, LANE_CHAT_WEIGHT};
+	unsigned int written = 0;
+	bool pending = true;
+	while(connected && pending && written < OUTBOUND_PASS_BUDGET) {
+		pending = false;
+		for(unsigned short lane = 0; lane < LANE_COUNT; lane++) {
+			if(lane == LANE_PRIVATE && deliveringOffline && lanes[LANE_PRIVATE].empty())
+				pullOffline();
+			if(lane == LANE_CHAT && ring != nullptr && lanes[LANE_CHAT].empty())
+				pullChat(weights[LANE_CHAT]);
+			for(unsigned short i = 0; i < weights[lane] && !lanes[lane].empty(); i++) {
+				written += appendFrame(*lanes[lane].front());
+				lanes[lane].pop_front();
+			}
+			if(!lanes[lane].empty())
+				pending = true;
+		}
+		if(ring != nullptr && ring->getHead() != ringCursor)
+			pending = true;
+	}
+}
+
+/* Copies the frame into the outgoing stream, sending the stream first if there isn't room left for it.
+	Returns how many bytes were added.
+	Must be called with the mutex locked.
+*/
+unsigned short PacketHandler::appendFrame(const string& frame) {
+	if(!connected)
+		return 0;
+	if(frame.size() >= stream->getSize())
+		throw runtime_error("Frame too large to send: " + to_string(frame.size()));
+	if(stream->getWriteIndex().getPosition() + frame.size() >= stream->getSize())
+		sendStream();
+	Cursor& idx = stream->getWriteIndex();
+	int curIdx = idx.getPosition();
+	idx += (int)frame.size();
+	memcpy(stream->getOutputBuffer() + curIdx, frame.data(), frame.size());
+	return (unsigned short)frame.size();
+}
+
+/* Writes out what's waiting in the lanes and sends it to the client. */
+void PacketHandler::flush(bool self) {
+	if(!connected)
+		return;
+	unique_lock<mutex> lock(mtx, defer_lock); //Released even if writing throws.
+	if(!self)
+		lock.lock();
+	writeLanes();
+	if(connected && stream->getWriteIndex().getPosition() > 0)
+		sendStream();
+}
+
+/* Sends the accumulated payload in the outgoing stream to the client, must be called with the mutex locked.
 	First it sends how many bytes will actually be inside the payload inside 2 bytes. It will keep looping to ensure these 2 bytes were successfully sent.
 	Next it will send the entire payload and keep looping until all of the payload was sent.
 	See the readLoop() description for the reasoning behind this.
 */
-void PacketHandler::flush(bool self) {
+void PacketHandler::sendStream() {
 	if(!connected)
 		return;
-	if(!self)
-		mtx.lock();
 	unsigned short totalSent = 0;
 	unsigned short desiredSize = stream->getWriteIndex().getPosition();
 	*peeker << desiredSize;
@@ -405,8 +718,6 @@ void PacketHandler::flush(bool self) {
 		int sent = send(socket, peeker->getOutputBuffer() + totalSent, totalSize - totalSent, 0);
 		if(sent == SOCKET_ERROR) { //Possibly lost connection.
 			user->disconnect();
-			if(!self)
-				mtx.unlock();
 			return;
 		}
 		totalSent += sent;
@@ -420,8 +731,6 @@ void PacketHandler::flush(bool self) {
 		int sent = send(socket, stream->getOutputBuffer() + totalSent, totalSize - totalSent, 0);
 		if(sent == SOCKET_ERROR) { //Possibly lost connection.
 			user->disconnect();
-			if(!self)
-				mtx.unlock();
 			return;
 		}
 		totalSent += sent;
@@ -431,8 +740,6 @@ void PacketHandler::flush(bool self) {
 	}
 	peeker->resetWrite();
 	stream->resetWrite();
-	if(!self)
-		mtx.unlock();
 }
 
 /* Sets weither or not the client is connected, if not it will close the socket. */
@@ -455,5 +762,6 @@ PacketHandler::~PacketHandler() {
 		socket = INVALID_SOCKET;
 	}
 	delete peeker;
+	delete scratch;
 	delete stream;
 }
\ No newline at end of file
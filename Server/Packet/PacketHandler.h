@@ -2,10 +2,20 @@
 #define PACKET_HANDLER_H_
 #include "../Constants.h"
 #include "Packet.h"
+#include "Frame.h"
+#include "../BroadcastRing.h"
+#include "../Storage/OfflineSpool.h"
 #include <winsock2.h>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <deque>
+#include <memory>
+#include <vector>
+#define LANE_CONTROL 0
+#define LANE_PRIVATE 1
+#define LANE_CHAT 2
+#define LANE_COUNT 3
 class Server;
 class User;
 
@@ -19,15 +29,34 @@ public:
 	bool isConnected() const;
 	Packet* const constructPacket(unsigned short);
 	void finializePacket(Packet* const packet, bool _flush = false);
+	void sendFrame(std::shared_ptr<const Frame> frame, unsigned short lane = LANE_CONTROL);
+	void subscribe(std::shared_ptr<BroadcastRing> ring, const std::vector<std::shared_ptr<const Frame>>& scrollback = {});
+	void unsubscribe();
 	void flush(bool self = false);
 private:
 	Server* const server;
 	SOCKET socket;
 	User* const user;
 	bool connected;
+	unsigned short wireFormat;
 	DataStream* const stream;
 	DataStream* const peeker;
+	DataStream* const scratch;
 	std::mutex mtx;
 	Packet* constructingPacket;
+	std::deque<std::shared_ptr<const std::string>> lanes[LANE_COUNT];
+	std::shared_ptr<BroadcastRing> ring;
+	unsigned long long ringCursor;
+	bool deliveringOffline;
+	OfflineCursor offlineCursor;
+	void completeLogin(bool resumed);
+	std::shared_ptr<const std::string> encodingFor(const std::shared_ptr<const Frame>& frame) const;
+	void enqueue(unsigned short lane, std::shared_ptr<const std::string> frame);
+	void pullChat(unsigned short maxEvents);
+	void pullOffline();
+	void queueOfflineBatch(const std::vector<OfflineMessage>& messages, bool last);
+	void writeLanes();
+	unsigned short appendFrame(const std::string& frame);
+	void sendStream();
 };
 #endif //PACKET_HANDLER_H_
\ No newline at end of file
@@ -1,22 +1,96 @@
 #include "Room.h"
 #include "User.h"
 #include "Server.h"
+#include "Packet/FrameCache.h"
+#include <algorithm>
 
+std::atomic<unsigned long long> Room::scrollbackTotalBytes(0);
+std::atomic<unsigned long long> Room::scrollbackSequence(0);
+std::vector<Room*> Room::scrollbackRooms;
+std::mutex Room::scrollbackRoomsMutex;
 
-Room::Room(Server* const server, User* const owner, std::string roomName) :
+
+Room::Room(Server* const server, unsigned short roomId, User* const owner, std::string roomName) :
 	server(server),
+	roomId(roomId),
 	owner(owner),
-	roomName(roomName),
+	roomName(server->getSymbolTable().get(server->getSymbolTable().intern(roomName))),
 	userList{nullptr},
-	userCount(0) {
+	userCount(0),
+	memberCountDirty(false),
+	statusWindowOpen(false),
+	ring(std::make_shared<BroadcastRing>()),
+	scrollbackBytes(0) {
+	std::lock_guard<std::mutex> lock(scrollbackRoomsMutex);
+	scrollbackRooms.push_back(this);
+}
+
+/* Encodes a room message the same way User::sendMessage() does. */
+static std::shared_ptr<const Frame> encodeMessage(User* const from, const std::string& message, bool statusMessage, bool isSender) {
+	return FrameCache::encode(MESSAGE_PACKET_ID, [&](Packet& p) {
+		p << from->getUsername();
+		p << from->getUserNameColor();
+		p << from->getUserChatColor();
+		p << statusMessage;
+		p << false;
+		p << isSender;
+		p << message;
+	});
 }
 
-/* Relays a message to every user within the room. */
+/* Relays a message to every user within the room.
+	The message is encoded once (plus once more for the sender's own copy) and published to the room's ring, each member's writer picks it up from there.
+	The encoded frame is also kept in the room's scrollback. Both happen under the scrollback mutex, so a joining member gets each message from exactly one of them.
+*/
 void Room::sendMessage(User* const user, std::string message) {
-	for(unsigned short i = 0; i < MAX_ROOM_USERS; i++) {
-		if(userList[i] == nullptr)
-			continue;
-		userList[i]->sendMessage(user, message, false, false, userList[i] == user);
+	std::shared_ptr<const Frame> frame = encodeMessage(user, message, false, false);
+	std::shared_ptr<const Frame> senderFrame = encodeMessage(user, message, false, true);
+	scrollbackMutex.lock();
+	ring->publish(frame, senderFrame, user->getUserId());
+	keepScrollback(frame);
+	scrollbackMutex.unlock();
+	if(scrollbackTotalBytes > SCROLLBACK_TOTAL_BYTES)
+		trimScrollbackTotal();
+}
+
+/* Adds a message frame to the scrollback, then drops the oldest frames until the room is within ROOM_SCROLLBACK_COUNT and ROOM_SCROLLBACK_BYTES. The newest frame is always kept.
+	Must be called with the scrollback mutex locked.
+*/
+void Room::keepScrollback(std::shared_ptr<const Frame> frame) {
+	scrollback.push_back({scrollbackSequence++, frame});
+	scrollbackBytes += frame->size();
+	scrollbackTotalBytes += frame->size();
+	while(scrollback.size() > 1 && (scrollback.size() > ROOM_SCROLLBACK_COUNT || scrollbackBytes > ROOM_SCROLLBACK_BYTES)) {
+		scrollbackBytes -= scrollback.front().frame->size();
+		scrollbackTotalBytes -= scrollback.front().frame->size();
+		scrollback.pop_front();
+	}
+}
+
+/* Drops the oldest scrollback frames across every room until all rooms together are within SCROLLBACK_TOTAL_BYTES, so a busy room pushes out a quiet room's stale history rather than only its own.
+	Only one room's scrollback mutex is held at a time, and never while taking scrollbackRoomsMutex, so rooms trimming at once can't deadlock.
+	Must be called without any scrollback mutex locked.
+*/
+void Room::trimScrollbackTotal() {
+	std::lock_guard<std::mutex> lock(scrollbackRoomsMutex);
+	while(scrollbackTotalBytes > SCROLLBACK_TOTAL_BYTES) {
+		Room* oldest = nullptr;
+		unsigned long long oldestSequence = 0;
+		for(Room* const room : scrollbackRooms) {
+			std::lock_guard<std::mutex> roomLock(room->scrollbackMutex);
+			if(!room->scrollback.empty() && (oldest == nullptr || room->scrollback.front().sequence < oldestSequence)) {
+				oldest = room;
+				oldestSequence = room->scrollback.front().sequence;
+			}
+		}
+		if(oldest == nullptr)
+			break;
+		std::lock_guard<std::mutex> roomLock(oldest->scrollbackMutex);
+		if(!oldest->scrollback.empty() && oldest->scrollback.front().sequence == oldestSequence) { //Otherwise the room trimmed it itself meanwhile, look again.
+			oldest->scrollbackBytes -= oldest->scrollback.front().frame->size();
+			scrollbackTotalBytes -= oldest->scrollback.front().frame->size();
+			oldest->scrollback.pop_front();
+		}
 	}
 }
 
@@ -26,6 +100,7 @@ void Room::joinRoom(User* const user) {
 		if(userList[i] == nullptr) {
 			userList[i] = user;
 			userCount++;
+			members.set(user->getUserId());
 			user->setRoom(this);
 			break;
 		}
@@ -36,13 +111,27 @@ void Room::joinRoom(User* const user) {
 	user->getPacketHandler()->finializePacket(p);
 
 	if(user->getRoom() != nullptr) {
-		for(unsigned short i = 0; i < MAX_ROOM_USERS; i++) {
-			if(userList[i] == nullptr)
-				continue;
-			userList[i]->sendMessage(user, "has joined the room.", true, false, true);
+		scrollbackMutex.lock(); //Held while subscribing so no message lands between the scrollback and the ring.
+		std::vector<std::shared_ptr<const Frame>> frames;
+		for(const ScrollbackEntry& entry : scrollback) {
+			frames.push_back(entry.frame);
+		}
+		user->getPacketHandler()->subscribe(ring, frames);
+		scrollbackMutex.unlock();
+		announceStatus(user, true);
+		forEachMember([this, user](User* const member) {
+			if(userCount == ROOM_LARGE_MODE_THRESHOLD + 1 && member != user) //Just switched to large mode.
+				sendMemberPage(member, 0);
+			else if(member != user)
+				sendMemberDelta(member, ROOM_MEMBER_ADDED, user);
+		});
+		if(isLargeMode()) {
+			sendMemberPage(user, 0);
+			memberCountDirty = true;
+		} else {
+			updateRoomList(user);
 		}
-		updateRoomList();
-		server->updateRoomList();
+		server->queueRoomListDelta(ROOM_LIST_DELTA_COUNT, this);
 	}
 }
 
@@ -50,25 +139,34 @@ void Room::joinRoom(User* const user) {
 	Also once the owner leaves the room will be destroyed.
 */
 void Room::leaveRoom(User* const user) {
+	user->getPacketHandler()->unsubscribe();
 	Packet* p = user->getPacketHandler()->constructPacket(LEAVE_ROOM_PACKET_ID);
 	user->getPacketHandler()->finializePacket(p);
 	user->setRoom(nullptr);
 
 	for(unsigned short i = 0; i < MAX_ROOM_USERS; i++) {
-		if(userList[i] == nullptr)
-			continue;
 		if(userList[i] == user) {
 			userList[i] = nullptr;
 			userCount--;
-		} else {
-			userList[i]->sendMessage(user, "has left the room.", true, false, false);
+			members.reset(user->getUserId());
+			break;
 		}
 	}
+	announceStatus(user, false);
 	if(user == owner || userCount == 0) {
 		server->destroyRoom(this);
 	} else {
-		updateRoomList();
-		server->updateRoomList();
+		if(isLargeMode()) {
+			memberCountDirty = true;
+		} else {
+			forEachMember([this, user](User* const member) {
+				if(userCount == ROOM_LARGE_MODE_THRESHOLD) //Just left large mode, everyone needs the whole list again.
+					updateRoomList(member);
+				else
+					sendMemberDelta(member, ROOM_MEMBER_REMOVED, user);
+			});
+		}
+		server->queueRoomListDelta(ROOM_LIST_DELTA_COUNT, this);
 	}
 }
 
@@ -77,48 +175,221 @@ void Room::ensureEmpty() {
 	for(unsigned short i = 0; i < MAX_ROOM_USERS; i++) {
 		if(userList[i] == nullptr)
 			continue;
+		userList[i]->getPacketHandler()->unsubscribe();
 		Packet* p = userList[i]->getPacketHandler()->constructPacket(LEAVE_ROOM_PACKET_ID);
 		userList[i]->getPacketHandler()->finializePacket(p);
 		userList[i]->setRoom(nullptr);
 		userList[i] = nullptr;
 	}
+	members.reset();
 }
 
-/* Sends a room update to everyone inside the room. */
-void Room::updateRoomList() {
-	for(unsigned short i = 0; i < MAX_ROOM_USERS; i++) {
-		if(userList[i] == nullptr)
-			continue;
-		updateRoomList(userList[i]);
-	}
-}
-
-/* Sends the list of who is inside the room to a user. */
+/* Sends the full list of who is inside the room to a user.
+	The viewer's friends inside the room are found by masking their friend bitset with the room's member bitset rather than comparing names.
+	Afterwards the user is only sent deltas, this is only resent when they join or when they ask for it after missing a delta.
+*/
 void Room::updateRoomList(User* const user) {
+	UserTable& userTable = server->getUserTable();
+	const std::bitset<MAX_USERS> friendsInRoom = userTable.getFriendMask(user->getUserId()) & members;
 	Packet* p = user->getPacketHandler()->constructPacket(UPDATE_ROOM_LIST_PACKET_ID);
-	*p << userCount;
+	*p << (int)user->nextMemberListVersion();
+	*p << (unsigned short)userCount;
 	for(unsigned short i2 = 0; i2 < MAX_ROOM_USERS; i2++) {
 		if(userList[i2] == nullptr)
 			continue;
-		*p << (user->isFriend(userList[i2]->getUsername()) ? (unsigned short)FRIEND_COLOR : userList[i2]->getUserNameColor());
+		unsigned short memberId = userList[i2]->getUserId();
+		*p << (friendsInRoom.test(memberId) ? (unsigned short)FRIEND_COLOR : userTable.getNameColor(memberId));
 		*p << userList[i2]->getUsername();
 	}
 	user->getPacketHandler()->finializePacket(p);
 }
 
+/* Sends a single change of the room's member list to the viewer, tagged with the next version of the viewer's member list. */
+void Room::sendMemberDelta(User* const viewer, unsigned short type, User* const member) {
+	if(isLargeMode())
+		return;
+	Packet* p = viewer->getPacketHandler()->constructPacket(ROOM_MEMBER_DELTA_PACKET_ID);
+	*p << (int)viewer->nextMemberListVersion();
+	*p << type;
+	*p << (type == ROOM_MEMBER_REMOVED ? (unsigned short)DEFAULT_COLOR : getMemberColor(viewer, member));
+	*p << member->getUsername();
+	viewer->getPacketHandler()->finializePacket(p);
+}
+
+/* Lets everyone that doesn't see the member in their friend color know the member's name color changed. */
+void Room::memberRecolored(User* const member) {
+	if(isLargeMode())
+		return;
+	UserTable& userTable = server->getUserTable();
+	for(unsigned short i = 0; i < MAX_ROOM_USERS; i++) {
+		if(userList[i] == nullptr || userTable.getFriendMask(userList[i]->getUserId()).test(member->getUserId()))
+			continue;
+		sendMemberDelta(userList[i], ROOM_MEMBER_RECOLORED, member);
+	}
+}
+
+/* Returns the color the viewer should see the member's name in. */
+unsigned short Room::getMemberColor(User* const viewer, User* const member) {
+	UserTable& userTable = server->getUserTable();
+	if(userTable.getFriendMask(viewer->getUserId()).test(member->getUserId()))
+		return FRIEND_COLOR;
+	return userTable.getNameColor(member->getUserId());
+}
+
+/* Returns true if the room has too many users to keep every member's list up to date.
+	In large mode members are only sent the member count and whichever page of the member list they ask for.
+*/
+bool Room::isLargeMode() const {
+	return userCount > ROOM_LARGE_MODE_THRESHOLD;
+}
+
+/* Sends one page of the member list to the viewer along with the total member count. */
+void Room::sendMemberPage(User* const viewer, unsigned short page) {
+	UserTable& userTable = server->getUserTable();
+	const std::bitset<MAX_USERS> friendsInRoom = userTable.getFriendMask(viewer->getUserId()) & members;
+	User* pageUsers[ROOM_MEMBER_PAGE_SIZE];
+	unsigned short pageCount = 0;
+	unsigned short skip = page * ROOM_MEMBER_PAGE_SIZE;
+	for(unsigned short i = 0; i < MAX_ROOM_USERS && pageCount < ROOM_MEMBER_PAGE_SIZE; i++) {
+		if(userList[i] == nullptr)
+			continue;
+		if(skip > 0) {
+			skip--;
+			continue;
+		}
+		pageUsers[pageCount++] = userList[i];
+	}
+	Packet* p = viewer->getPacketHandler()->constructPacket(ROOM_MEMBER_PAGE_PACKET_ID);
+	*p << (unsigned short)userCount;
+	*p << page;
+	*p << pageCount;
+	for(unsigned short i = 0; i < pageCount; i++) {
+		unsigned short memberId = pageUsers[i]->getUserId();
+		*p << (friendsInRoom.test(memberId) ? (unsigned short)FRIEND_COLOR : userTable.getNameColor(memberId));
+		*p << pageUsers[i]->getUsername();
+	}
+	viewer->getPacketHandler()->finializePacket(p);
+}
+
+/* Lists the viewer's friends that are inside the room as server messages. */
+void Room::sendFriendsInRoom(User* const viewer) {
+	const std::bitset<MAX_USERS> friendsInRoom = server->getUserTable().getFriendMask(viewer->getUserId()) & members;
+	if(friendsInRoom.none()) {
+		viewer->sendServerMessage("None of your friends are in this room.", DEFAULT_COLOR);
+		return;
+	}
+	for(unsigned short i = 0; i < MAX_ROOM_USERS; i++) {
+		if(userList[i] != nullptr && friendsInRoom.test(userList[i]->getUserId()))
+			viewer->sendServerMessage(userList[i]->getUsername(), FRIEND_COLOR);
+	}
+}
+
+/* Publishes the current member count to everyone in a large room if it changed since the last tick. */
+void Room::flushMemberCount() {
+	if(!memberCountDirty.exchange(false))
+		return;
+	if(!isLargeMode())
+		return;
+	std::shared_ptr<const Frame> frame = FrameCache::encode(ROOM_MEMBER_COUNT_PACKET_ID, [this](Packet& p) {
+		p << (unsigned short)userCount;
+	});
+	ring->publish(frame, frame);
+}
+
+/* Runs the action for every user in the room. */
+void Room::forEachMember(const std::function<void(User* const)>& action) {
+	for(unsigned short i = 0; i < MAX_ROOM_USERS; i++) {
+		if(userList[i] != nullptr)
+			action(userList[i]);
+	}
+}
+
+/* Lets the room know the user joined or left.
+	The first change after a quiet period is sent right away, any more changes within ROOM_STATUS_AGGREGATION_MS are collected and sent as one summary by flushStatusMessages().
+*/
+void Room::announceStatus(User* const user, bool joined) {
+	statusMutex.lock();
+	if(statusWindowOpen) {
+		(joined ? pendingJoins : pendingLeaves).push_back(user->getUsername());
+		statusMutex.unlock();
+		return;
+	}
+	statusWindowOpen = true;
+	statusWindowStart = std::chrono::steady_clock::now();
+	statusMutex.unlock();
+	std::shared_ptr<const Frame> frame = encodeMessage(user, joined ? "has joined the room." : "has left the room.", true, joined);
+	ring->publish(frame, frame, user->getUserId());
+}
+
+/* Builds a summary such as "alice and 37 others have joined the room." */
+static std::string summarizeStatus(const std::vector<std::string>& names, const std::string& action) {
+	if(names.size() == 1)
+		return names[0] + " has " + action + " the room.";
+	if(names.size() == 2)
+		return names[0] + " and " + names[1] + " have " + action + " the room.";
+	return names[0] + " and " + std::to_string(names.size() - 1) + " others have " + action + " the room.";
+}
+
+/* Sends the joins and leaves collected since the aggregation window opened, called every server tick.
+	The window stays open while changes keep arriving so a steady stream of churn is only ever announced once per window.
+*/
+void Room::flushStatusMessages() {
+	std::vector<std::string> joins;
+	std::vector<std::string> leaves;
+	statusMutex.lock();
+	if(!statusWindowOpen || std::chrono::steady_clock::now() - statusWindowStart < std::chrono::milliseconds(ROOM_STATUS_AGGREGATION_MS)) {
+		statusMutex.unlock();
+		return;
+	}
+	joins.swap(pendingJoins);
+	leaves.swap(pendingLeaves);
+	statusWindowOpen = !joins.empty() || !leaves.empty();
+	statusWindowStart = std::chrono::steady_clock::now();
+	statusMutex.unlock();
+	if(joins.empty() && leaves.empty())
+		return;
+	if(!joins.empty())
+		publishServerMessage(summarizeStatus(joins, "joined"));
+	if(!leaves.empty())
+		publishServerMessage(summarizeStatus(leaves, "left"));
+}
+
+/* Publishes a server message to everyone in the room through the room's ring. */
+void Room::publishServerMessage(const std::string& message) {
+	std::shared_ptr<const Frame> frame = FrameCache::encode(SERVER_MESSAGE_PACKET_ID, [&](Packet& p) {
+		p << "<" + std::to_string(DEFAULT_COLOR) + ">" + message;
+	});
+	ring->publish(frame, frame);
+}
+
 /* Returns the list of users inside the room. */
 User** const Room::getUserList() {
 	return userList;
 }
 
+/* Returns the set of user ids inside the room. */
+const std::bitset<MAX_USERS>& Room::getMembers() const {
+	return members;
+}
+
 /* Returns the user that is the owner of this room. */
 User* const Room::getOwner() {
 	return owner;
 }
 
+/* Returns the index of this room within the server's room list. */
+unsigned short Room::getRoomId() const {
+	return roomId;
+}
+
 /* Returns the name of this room. */
-std::string Room::getName() {
-	return roomName;
+const std::string& Room::getName() const {
+	return roomName.name;
+}
+
+/* Returns the interned id of this room's name. */
+SymbolId Room::getNameId() const {
+	return roomName.id;
 }
 
 /* Returns the number of users within this room. */
@@ -127,5 +398,9 @@ unsigned short Room::getUserCount() {
 }
 
 Room::~Room() {
-
+	scrollbackRoomsMutex.lock();
+	scrollbackRooms.erase(std::find(scrollbackRooms.begin(), scrollbackRooms.end(), this));
+	scrollbackRoomsMutex.unlock();
+	server->getSymbolTable().release(roomName.id);
+	scrollbackTotalBytes -= scrollbackBytes;
 }
\ No newline at end of file
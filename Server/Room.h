@@ -2,28 +2,75 @@
 #define ROOM_H_
 #include "Constants.h"
 #include <string>
+#include <bitset>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <deque>
+#include <atomic>
+#include "SymbolTable.h"
+#include "BroadcastRing.h"
 class User;
 class Server;
 
+/* A message frame kept in a room's scrollback, numbered in the order it was kept across all rooms. */
+struct ScrollbackEntry {
+	unsigned long long sequence;
+	std::shared_ptr<const Frame> frame;
+};
+
 class Room {
 public:
-	Room(Server* const server, User* const owner, std::string roomName);
+	Room(Server* const server, unsigned short roomId, User* const owner, std::string roomName);
 	~Room();
 	void joinRoom(User* const user);
 	void leaveRoom(User* const user);
 	User* const getOwner();
-	std::string getName();
+	unsigned short getRoomId() const;
+	const std::string& getName() const;
+	SymbolId getNameId() const;
 	User** const getUserList();
-	void updateRoomList();
+	const std::bitset<MAX_USERS>& getMembers() const;
 	void updateRoomList(User* const user);
+	void sendMemberDelta(User* const viewer, unsigned short type, User* const member);
+	void memberRecolored(User* const member);
+	unsigned short getMemberColor(User* const viewer, User* const member);
+	bool isLargeMode() const;
+	void sendMemberPage(User* const viewer, unsigned short page);
+	void sendFriendsInRoom(User* const viewer);
+	void flushMemberCount();
+	void announceStatus(User* const user, bool joined);
+	void flushStatusMessages();
+	void publishServerMessage(const std::string& message);
+	void forEachMember(const std::function<void(User* const)>& action);
 	unsigned short getUserCount();
 	void ensureEmpty();
 	void sendMessage(User* const user, std::string message);
 private:
 	Server* const server;
+	const unsigned short roomId;
 	User* const owner;
-	std::string roomName;
+	const Symbol& roomName;
 	User* userList[MAX_ROOM_USERS];
-	unsigned short userCount;
+	std::atomic<unsigned short> userCount;
+	std::bitset<MAX_USERS> members;
+	std::atomic<bool> memberCountDirty;
+	std::mutex statusMutex;
+	bool statusWindowOpen;
+	std::chrono::steady_clock::time_point statusWindowStart;
+	std::vector<std::string> pendingJoins;
+	std::vector<std::string> pendingLeaves;
+	std::shared_ptr<BroadcastRing> ring;
+	std::deque<ScrollbackEntry> scrollback;
+	unsigned long long scrollbackBytes;
+	std::mutex scrollbackMutex;
+	static std::atomic<unsigned long long> scrollbackTotalBytes;
+	static std::atomic<unsigned long long> scrollbackSequence;
+	static std::vector<Room*> scrollbackRooms;
+	static std::mutex scrollbackRoomsMutex;
+	void keepScrollback(std::shared_ptr<const Frame> frame);
+	static void trimScrollbackTotal();
 };
 #endif
\ No newline at end of file
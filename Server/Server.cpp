@@ -1,12 +1,16 @@
 #include "Server.h"
 #include "User.h"
 #include "Room.h"
+#include "Friend.h"
 #include "Constants.h"
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <iostream>
 #include "Exception/StartupException.h"
 #include <fstream>
+#include <chrono>
+#include <ctime>
+#include <random>
 
 /* Library required for winsock usage. */
 #pragma comment (lib, "Ws2_32.lib")
@@ -21,6 +25,27 @@ int main() {
 			return 1;
 		}
 	}
+	if(!CreateDirectoryA(string(SPOOL_DIRECTORY).c_str(), NULL)) {
+		DWORD lastError = GetLastError();
+		if(lastError != ERROR_ALREADY_EXISTS) {
+			cout << "Error #" << lastError << " making the spool directory: " << SPOOL_DIRECTORY << endl;
+			return 1;
+		}
+	}
+	if(!CreateDirectoryA(string(ARCHIVE_DIRECTORY).c_str(), NULL)) {
+		DWORD lastError = GetLastError();
+		if(lastError != ERROR_ALREADY_EXISTS) {
+			cout << "Error #" << lastError << " making the archive directory: " << ARCHIVE_DIRECTORY << endl;
+			return 1;
+		}
+	}
+	if(!CreateDirectoryA(string(EXPORT_DIRECTORY).c_str(), NULL)) {
+		DWORD lastError = GetLastError();
+		if(lastError != ERROR_ALREADY_EXISTS) {
+			cout << "Error #" << lastError << " making the export directory: " << EXPORT_DIRECTORY << endl;
+			return 1;
+		}
+	}
 
 	unsigned short portNum = 0;
 	string port = "";
@@ -52,11 +77,27 @@ Server::Server(unsigned int port) :
 	sSocket(INVALID_SOCKET),
 	listening(true),
 	roomCount(0),
+	roomListVersion(0),
+	frameCache(this),
+	userStore(SAVE_DIRECTORY),
+	persister(userStore),
+	offlineSpool(SPOOL_DIRECTORY),
+	chatArchive(ARCHIVE_DIRECTORY),
+	chatExporter(EXPORT_DIRECTORY),
+	sessionSnapshotter(SAVE_DIRECTORY),
+	sessionsChanged(false),
 	allowedUsernameChars("^[a-zA-Z0-9]*$") {
 	logFile.open(LOG_DIRECTORY + (string)"log.txt", ofstream::app);
 	if(!logFile.is_open()) {
 		throw exception("Could not open log file.");
 	}
+	if(userStore.isEmpty()) {
+		unsigned int imported = userStore.importTextFiles(SAVE_DIRECTORY);
+		if(imported > 0)
+			log("Imported " + to_string(imported) + " users from text save files.");
+	}
+	loadSessionSnapshot();
+	registryThreadInstance = thread(&Server::loadUsernameRegistry, this);
 }
 
 /* Starts the server
@@ -106,6 +147,7 @@ bool Server::start() {
 
 /* Listens for connections and upon a connection constructs a user. */
 void Server::doListen() {
+	tickThreadInstance = thread(&Server::tickLoop, this);
 mainLoop: while(listening) {
 	SOCKET userSocket = accept(sSocket, NULL, NULL);
 	if(userSocket == INVALID_SOCKET) {
@@ -115,6 +157,7 @@ mainLoop: while(listening) {
 
 	for(unsigned short i = 0; i < MAX_USERS; i++) {
 		if(userList[i] == nullptr) {
+			userTable.reset(i);
 			userList[i] = new User(this, i, userSocket);
 			goto mainLoop;
 		}
@@ -124,6 +167,68 @@ mainLoop: while(listening) {
 }
 }
 
+/* Fills the username registry from the user store, run on its own thread at startup so connections are accepted meanwhile.
+	Accounts created while this runs are added to the registry directly.
+*/
+void Server::loadUsernameRegistry() {
+	vector<string> names = userStore.getNames();
+	for(const string& name : names) {
+		if(!listening)
+			return;
+		usernameRegistry.add(name);
+	}
+	usernameRegistry.setLoaded();
+	log("Loaded " + to_string(usernameRegistry.size()) + " registered usernames.");
+}
+
+/* Periodically sends out the work that is batched up between ticks, and snapshots the sessions at most every SNAPSHOT_INTERVAL_MS once they change.
+	Rooms and users removed on other threads are only deleted here, between passes, so the ones walked below stay alive even if they are removed meanwhile.
+*/
+void Server::tickLoop() {
+	chrono::steady_clock::time_point lastStats = chrono::steady_clock::now();
+	chrono::steady_clock::time_point lastSnapshot = chrono::steady_clock::now();
+	while(listening) {
+		deleteRetired();
+		flushRoomListDeltas();
+		flushPresenceChanges();
+		for(unsigned short i = 0; i < MAX_ROOMS; i++) {
+			Room* room = roomList[i];
+			if(room == nullptr)
+				continue;
+			room->flushMemberCount();
+			room->flushStatusMessages();
+		}
+		if(chrono::steady_clock::now() - lastStats >= chrono::milliseconds(PROFILE_STATS_LOG_MS)) {
+			lastStats = chrono::steady_clock::now();
+			string stats = profileCache.takeStats();
+			if(!stats.empty())
+				log(stats);
+		}
+		if(sessionsChanged && chrono::steady_clock::now() - lastSnapshot >= chrono::milliseconds(SNAPSHOT_INTERVAL_MS)) {
+			lastSnapshot = chrono::steady_clock::now();
+			sessionsChanged = false;
+			sessionSnapshotter.submit(captureSessionSnapshot());
+		}
+		this_thread::sleep_for(chrono::milliseconds(ROOM_LIST_COALESCE_MS));
+	}
+}
+
+/* Deletes the users and rooms removed since the last call, see tickLoop(). */
+void Server::deleteRetired() {
+	vector<User*> users;
+	vector<Room*> rooms;
+	retiredMutex.lock();
+	users.swap(retiredUsers);
+	rooms.swap(retiredRooms);
+	retiredMutex.unlock();
+	for(User* user : users) {
+		delete user;
+	}
+	for(Room* room : rooms) {
+		delete room;
+	}
+}
+
 /* Returns the servers room list array. */
 Room** const Server::getRoomList() {
 	return roomList;
@@ -137,66 +242,227 @@ Room* const Server::makeRoom(User* const owner, string roomName) {
 		if(roomList[i] == nullptr) {
 			roomCount++;
 			log(owner->getUsername() + " created room " + roomName + ".");
-			return (roomList[i] = new Room(this, owner, roomName));
+			roomList[i] = new Room(this, i, owner, roomName);
+			queueRoomListDelta(ROOM_LIST_DELTA_ADDED, roomList[i]);
+			return roomList[i];
 		}
 	}
 	return nullptr;
 }
 
-/* Destroys the room, first ensures everyone has left it. */
+/* Destroys the room, first ensures everyone has left it. The room is taken off the room list right away and deleted by the tick thread. */
 void Server::destroyRoom(Room* const room) {
 	for(unsigned short i = 0; i < MAX_ROOMS; i++) {
 		if(roomList[i] == room) {
 			log("Room " + room->getName() + " destroyed.");
-			roomList[i]->ensureEmpty();
-			delete roomList[i];
+			queueRoomListDelta(ROOM_LIST_DELTA_REMOVED, room);
+			room->ensureEmpty();
 			roomList[i] = nullptr;
 			roomCount--;
+			lock_guard<mutex> lock(retiredMutex);
+			retiredRooms.push_back(room);
 			break;
 		}
 	}
-	updateRoomList();
 }
 
-/* Sends a room list update to everyone connected. */
-void Server::updateRoomList() {
+/* Puts the user in the room with the given name, making the room with them as the owner if it doesn't exist yet.
+	The user is told the join failed if there is no space left for another room.
+*/
+void Server::joinOrMakeRoom(User* const user, string roomName) {
+	SymbolId roomNameId = symbolTable.find(roomName);
+	for(unsigned short i = 0; roomNameId != NO_SYMBOL && i < MAX_ROOMS; i++) {
+		if(roomList[i] != nullptr && roomList[i]->getNameId() == roomNameId) {
+			roomList[i]->joinRoom(user);
+			return;
+		}
+	}
+	Room* newRoom = makeRoom(user, roomName);
+	if(newRoom == nullptr) {
+		Packet* p = user->getPacketHandler()->constructPacket(ATTEMPT_JOIN_ROOM_PACKET_ID);
+		*p << (unsigned short)ATTEMPT_JOIN_ROOM_FAILURE;
+		user->getPacketHandler()->finializePacket(p);
+	} else {
+		newRoom->joinRoom(user);
+	}
+}
+
+/* Queues a change to the room list to be sent out on the next tick.
+	Changes to the same room within one tick are merged so a burst of joins only sends the latest member count.
+	Only the latest queued change for the name is merged with, a room can be removed and another made with the same name within one tick and the earlier changes belong to the old room.
+*/
+void Server::queueRoomListDelta(unsigned short type, Room* const room) {
+	lock_guard<mutex> lock(roomListMutex);
+	for(auto it = pendingRoomListDeltas.rbegin(); it != pendingRoomListDeltas.rend(); it++) {
+		if(it->name != room->getName())
+			continue;
+		if(type == ROOM_LIST_DELTA_COUNT && it->type != ROOM_LIST_DELTA_REMOVED) {
+			it->userCount = room->getUserCount();
+			return;
+		}
+		if(type == ROOM_LIST_DELTA_REMOVED && it->type == ROOM_LIST_DELTA_ADDED) { //Never seen by clients, drop it entirely.
+			pendingRoomListDeltas.erase(next(it).base());
+			return;
+		}
+		break;
+	}
+	pendingRoomListDeltas.push_back({type, room->getName(), room->getUserCount()});
+}
+
+/* Sends every queued room list change as a single versioned packet to each authenticated user. */
+void Server::flushRoomListDeltas() {
+	vector<RoomListDelta> deltas;
+	unsigned int version;
+	roomListMutex.lock();
+	deltas.swap(pendingRoomListDeltas);
+	version = (deltas.empty() ? roomListVersion : ++roomListVersion);
+	roomListMutex.unlock();
+	if(deltas.empty())
+		return;
+	frameCache.invalidate(FRAME_ROOM_LIST);
 	for(unsigned short i = 0; i < MAX_USERS; i++) {
-		if(userList[i] == nullptr)
+		User* user = userList[i];
+		if(!userTable.isAuthenticated(i) || user == nullptr)
 			continue;
-		updateRoomList(userList[i]);
+		PacketHandler* packetHandler = user->getPacketHandler();
+		Packet* p = packetHandler->constructPacket(ROOM_LIST_DELTA_PACKET_ID);
+		*p << (int)version;
+		*p << (unsigned short)deltas.size();
+		for(RoomListDelta& delta : deltas) {
+			*p << delta.type;
+			*p << delta.name;
+			*p << delta.userCount;
+		}
+		packetHandler->finializePacket(p);
 	}
 }
 
-/* Sends a friend status update to anyone that is friends with the specified user. */
+/* Handles the user logging on or off for anyone that is friends with them.
+	Only the users found in the reverse friend index are visited, so the cost is the number of people that have this user added rather than every connected user.
+	Their friend entries are pointed at the new session right away, but the notification itself is debounced and sent by flushPresenceChanges().
+	The index lock is held while the entries are updated, a user removes themselves from the index before they are deleted so every user found in it is still alive.
+*/
 void Server::handleFriendStatusUpdate(User* const user) {
-	User** userList = getUserList();
-	for(unsigned short i = 0; i < MAX_USERS; i++) {
-		if(userList[i] == nullptr)
+	bool online = user->getPacketHandler()->isConnected();
+	const Symbol& name = user->getNameSymbol();
+	friendIndexMutex.lock();
+	auto found = friendedBy.find(name.foldedId);
+	if(found != friendedBy.end()) {
+		for(auto& entry : found->second) {
+			if(entry.first == user)
+				continue;
+			entry.first->setFriendSession(entry.second, online ? user : nullptr);
+		}
+	}
+	friendIndexMutex.unlock();
+
+	lock_guard<mutex> lock(presenceMutex);
+	auto pending = pendingPresence.find(name.foldedId);
+	if(pending == pendingPresence.end()) {
+		symbolTable.retain(name.id); //The user may be gone by the time the change is announced.
+		pendingPresence[name.foldedId] = {name.id, online, !online, chrono::steady_clock::now()};
+	} else {
+		pending->second.online = online;
+		pending->second.lastChange = chrono::steady_clock::now();
+	}
+}
+
+/* Announces presence changes that have settled for PRESENCE_DEBOUNCE_MS.
+	Changes that ended up back where they started (a quick reconnect) are dropped, and each recipient gets every change meant for them in a single packet.
+	Recipients are found through the reverse friend index, see handleFriendStatusUpdate() for why its lock keeps them alive.
+*/
+void Server::flushPresenceChanges() {
+	vector<PresenceChange> settled;
+	presenceMutex.lock();
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	for(auto it = pendingPresence.begin(); it != pendingPresence.end();) {
+		if(now - it->second.lastChange < chrono::milliseconds(PRESENCE_DEBOUNCE_MS)) {
+			it++;
+			continue;
+		}
+		if(it->second.online != it->second.announced)
+			settled.push_back(it->second);
+		else
+			symbolTable.release(it->second.nameId);
+		it = pendingPresence.erase(it);
+	}
+	presenceMutex.unlock();
+	if(settled.empty())
+		return;
+
+	unordered_map<User*, vector<PresenceChange*>> batches;
+	lock_guard<mutex> lock(friendIndexMutex); //Held until the batches are sent so none of the recipients can be deleted meanwhile.
+	for(PresenceChange& change : settled) {
+		auto found = friendedBy.find(symbolTable.get(change.nameId).foldedId);
+		if(found == friendedBy.end())
 			continue;
-		Friend* friendEntry = userList[i]->getFriend(user->getUsername());
-		if(friendEntry != nullptr) {
-			userList[i]->updateFriendStatus(user, friendEntry);
+		for(auto& entry : found->second) {
+			if(entry.first->isAuthenticated())
+				batches[entry.first].push_back(&change);
 		}
 	}
+	for(auto& batch : batches) {
+		PacketHandler* packetHandler = batch.first->getPacketHandler();
+		Packet* p = packetHandler->constructPacket(FRIEND_PRESENCE_BATCH_PACKET_ID);
+		*p << (unsigned short)batch.second.size();
+		for(PresenceChange* change : batch.second) {
+			*p << symbolTable.get(change->nameId).name;
+			*p << change->online;
+		}
+		packetHandler->finializePacket(p);
+	}
+	for(PresenceChange& change : settled) {
+		symbolTable.release(change.nameId);
+	}
 }
 
-/* Sends a room list update to a specific user. */
+/* Records in the reverse friend index that the user has the friend entry on their friends list. */
+void Server::addFriendReference(User* const user, Friend* const friendEntry) {
+	friendIndexMutex.lock();
+	friendedBy[friendEntry->getFoldedId()][user] = friendEntry;
+	friendIndexMutex.unlock();
+}
+
+/* Removes the friend entry of the user from the reverse friend index. */
+void Server::removeFriendReference(User* const user, Friend* const friendEntry) {
+	friendIndexMutex.lock();
+	auto found = friendedBy.find(friendEntry->getFoldedId());
+	if(found != friendedBy.end()) {
+		found->second.erase(user);
+		if(found->second.empty())
+			friendedBy.erase(found);
+	}
+	friendIndexMutex.unlock();
+}
+
+/* Sends the full room list to a specific user, along with the version that later deltas will build on. */
 void Server::updateRoomList(User* user) {
-	Packet* p = user->getPacketHandler()->constructPacket(ROOM_STATUS_UPDATE_PACKET_ID);
-	*p << roomCount;
+	user->getPacketHandler()->sendFrame(frameCache.get(FRAME_ROOM_LIST));
+}
+
+/* Writes the full room list along with the version it corresponds to. */
+void Server::writeRoomList(Packet& p) {
+	lock_guard<mutex> lock(roomListMutex);
+	p << (int)roomListVersion;
+	p << roomCount;
 	for(unsigned short i2 = 0; i2 < MAX_ROOMS; i2++) {
 		if(roomList[i2] == nullptr)
 			continue;
-		*p << roomList[i2]->getName();
+		p << roomList[i2]->getName();
+		p << roomList[i2]->getUserCount();
 	}
-	user->getPacketHandler()->finializePacket(p);
 }
 
-/* Removes the user from the user list and deletes them. */
+/* Removes the user from the user list, they are deleted by the tick thread.
+	Their friends are cleared first since their slot in the user table can be handed to a new connection before then.
+*/
 void Server::removeUser(User* user) {
 	log((user->getUsername().empty() ? user->getIp() : user->getUsername()) + " disconnected.");
+	user->clearFriends();
 	userList[user->getUserId()] = nullptr;
-	delete user;
+	userTable.clear(user->getUserId());
+	lock_guard<mutex> lock(retiredMutex);
+	retiredUsers.push_back(user);
 }
 
 /* Returns the user list array. */
@@ -204,20 +470,211 @@ User** const Server::getUserList() {
 	return userList;
 }
 
+/* Returns the table of hot per-session fields. */
+UserTable& Server::getUserTable() {
+	return userTable;
+}
+
+/* Returns the table of interned user and room names. */
+SymbolTable& Server::getSymbolTable() {
+	return symbolTable;
+}
+
+/* Returns the cache of pre-encoded server responses. */
+FrameCache& Server::getFrameCache() {
+	return frameCache;
+}
+
+/* Returns the background writer for user save files. */
+UserPersister& Server::getPersister() {
+	return persister;
+}
+
+/* Returns the store holding every user's saved record. */
+UserStore& Server::getUserStore() {
+	return userStore;
+}
+
+/* Returns the registry of every registered username. */
+UsernameRegistry& Server::getUsernameRegistry() {
+	return usernameRegistry;
+}
+
+/* Returns the spool holding private messages for offline users. */
+OfflineSpool& Server::getOfflineSpool() {
+	return offlineSpool;
+}
+
+/* Returns the searchable archive of room messages. */
+ChatArchive& Server::getChatArchive() {
+	return chatArchive;
+}
+
+/* Returns the exporter writing chat and command events for analysis. */
+ChatExporter& Server::getChatExporter() {
+	return chatExporter;
+}
+
+/* Finds the user's latest saved record, trying the profile cache, then saves still waiting to be written, then the store.
+	Records found outside the cache are cached for next time, unless a save cached the user meanwhile. Returns false if the user has never been saved.
+*/
+bool Server::findUserRecord(const string& lowercaseName, UserRecord& record) {
+	if(profileCache.get(lowercaseName, record))
+		return true;
+	if(!persister.findPending(lowercaseName, record) && !userStore.find(lowercaseName, record))
+		return false;
+	profileCache.putIfAbsent(lowercaseName, record);
+	return true;
+}
+
+/* Saves the user's record, updating the profile cache right away and the store in the background. */
+void Server::saveUserRecord(const string& lowercaseName, const UserRecord& record) {
+	profileCache.put(lowercaseName, record);
+	persister.markDirty(lowercaseName, record);
+}
+
 /* Finds the user in the user list by the specified name.
 - Returns nullptr if no one was found by that name.
 - Returns the user pointer if the name was found. */
 User* const Server::getUserByName(string name) {
 	if(name.empty())
 		return nullptr;
-	transform(name.begin(), name.end(), name.begin(), ::tolower);
+	SymbolId foldedNameId = symbolTable.find(SymbolTable::fold(name));
+	if(foldedNameId == NO_SYMBOL)
+		return nullptr;
+	return getUserBySymbol(foldedNameId);
+}
+
+/* Finds the user by the interned id of their lowercase name.
+	The scan only touches the authenticated flags and name ids in the user table.
+- Returns nullptr if no one was found by that name.
+- Returns the user pointer if the name was found. */
+User* const Server::getUserBySymbol(SymbolId foldedNameId) {
+	int userId = userTable.findAuthenticated(foldedNameId);
+	return userId == -1 ? nullptr : userList[userId];
+}
+
+/* Gives the user a new random token they can resume their session with after losing their connection or a server restart.
+	Any sessions still kept resumable for them under older tokens are dropped, so logging in again invalidates those tokens.
+*/
+string Server::issueResumeToken(User* const user) {
+	static const char hexDigits[] = "0123456789abcdef";
+	random_device random;
+	string token;
+	for(unsigned short i = 0; i < RESUME_TOKEN_BYTES / 4; i++) {
+		unsigned int value = random();
+		for(int shift = 28; shift >= 0; shift -= 4) {
+			token += hexDigits[(value >> shift) & 0xF];
+		}
+	}
+	lock_guard<mutex> lock(sessionMutex);
+	for(auto it = resumableSessions.begin(); it != resumableSessions.end();) {
+		if(it->second.lowercaseName == user->getUsernameLowercase())
+			it = resumableSessions.erase(it);
+		else
+			it++;
+	}
+	user->setResumeToken(token);
+	sessionsChanged = true;
+	return token;
+}
+
+/* Keeps a disconnecting user's session resumable for RESUME_WINDOW_SECONDS, along with the room they were in. */
+void Server::keepResumableSession(User* const user) {
+	lock_guard<mutex> lock(sessionMutex);
+	if(user->getResumeToken().empty())
+		return;
+	resumableSessions[user->getResumeToken()] = {user->getResumeToken(), user->getUsernameLowercase(), user->getRoom() == nullptr ? "" : user->getRoom()->getName(), (long long)time(nullptr) + RESUME_WINDOW_SECONDS};
+	sessionsChanged = true;
+}
+
+/* Checks that the token belongs to the user and hasn't expired, setting roomName to the room they were in.
+	The session is left in place so it isn't lost if loading the user fails, see consumeResumableSession().
+	Returns false if the session can't be resumed.
+*/
+bool Server::findResumableSession(const string& token, string username, string& roomName) {
+	transform(username.begin(), username.end(), username.begin(), ::tolower);
+	lock_guard<mutex> lock(sessionMutex);
+	auto found = resumableSessions.find(token);
+	if(found == resumableSessions.end() || found->second.lowercaseName != username || found->second.expires < (long long)time(nullptr))
+		return false;
+	roomName = found->second.room;
+	return true;
+}
+
+/* Uses up a resumable session once the user has been loaded.
+	Returns false if it was already used up by another connection meanwhile.
+*/
+bool Server::consumeResumableSession(const string& token) {
+	lock_guard<mutex> lock(sessionMutex);
+	if(resumableSessions.erase(token) == 0)
+		return false;
+	sessionsChanged = true;
+	return true;
+}
+
+/* Notes that a session joined, left or changed rooms so the next tick writes a new snapshot. */
+void Server::markSessionsChanged() {
+	sessionsChanged = true;
+}
+
+/* Captures every connected session and every disconnected one still inside its resume window, dropping those that have expired. */
+shared_ptr<const ServerSnapshot> Server::captureSessionSnapshot() {
+	shared_ptr<ServerSnapshot> snapshot = make_shared<ServerSnapshot>();
+	snapshot->time = (long long)time(nullptr);
+	lock_guard<mutex> lock(sessionMutex);
+	for(auto it = resumableSessions.begin(); it != resumableSessions.end();) {
+		if(it->second.expires < snapshot->time) {
+			it = resumableSessions.erase(it);
+			continue;
+		}
+		snapshot->sessions.push_back(it->second);
+		it++;
+	}
 	for(unsigned short i = 0; i < MAX_USERS; i++) {
-		if(userList[i] == nullptr)
+		User* user = userList[i];
+		if(user == nullptr || !userTable.isAuthenticated(i) || user->getResumeToken().empty())
 			continue;
-		if(userList[i]->isAuthenticated() && userList[i]->getUsernameLowercase() == name)
-			return userList[i];
+		Room* room = user->getRoom();
+		snapshot->sessions.push_back({user->getResumeToken(), user->getUsernameLowercase(), room == nullptr ? "" : room->getName(), 0});
 	}
-	return nullptr;
+	return snapshot;
+}
+
+/* Restores the sessions from the last snapshot so their users can resume them.
+	Sessions that were connected when the snapshot was taken get RESUME_WINDOW_SECONDS from now, the rest keep the expiry they had.
+	Rooms aren't made until a member resumes into them, a room needs a connected owner.
+*/
+void Server::loadSessionSnapshot() {
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ServerSnapshot snapshot;
+	if(!sessionSnapshotter.load(snapshot))
+		return;
+	long long now = (long long)time(nullptr);
+	lock_guard<mutex> lock(sessionMutex);
+	for(SnapshotSession& session : snapshot.sessions) {
+		if(session.expires == 0)
+			session.expires = now + RESUME_WINDOW_SECONDS;
+		if(session.expires >= now)
+			resumableSessions[session.token] = session;
+	}
+	long long took = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+	log("Restored " + to_string(resumableSessions.size()) + " resumable sessions from the snapshot in " + to_string(took) + "ms.");
+}
+
+/* Spools a private message for a registered user who isn't online, to be delivered when they next log in.
+	Returns SPOOL_QUEUED, SPOOL_NO_SUCH_USER if no one is registered with that name, SPOOL_FULL if they already have SPOOL_MAX_MESSAGES_PER_USER messages waiting
+	or SPOOL_TOO_LONG if the message is over SPOOL_MAX_MESSAGE_LENGTH, which keeps every spooled message small enough to fit in a single OFFLINE_MESSAGES packet.
+*/
+unsigned short Server::spoolOfflineMessage(User* const from, string recipientName, const string& message) {
+	if(!doesRegisteredUsernameExist(recipientName))
+		return SPOOL_NO_SUCH_USER;
+	if(message.length() > SPOOL_MAX_MESSAGE_LENGTH)
+		return SPOOL_TOO_LONG;
+	transform(recipientName.begin(), recipientName.end(), recipientName.begin(), ::tolower);
+	if(!offlineSpool.enqueue(recipientName, {from->getUsername(), from->getUserNameColor(), from->getUserChatColor(), message}))
+		return SPOOL_FULL;
+	return SPOOL_QUEUED;
 }
 
 /* Checks to see if the username contains invalid characters. Return true if it is acceptable, otherwise false. */
@@ -226,43 +683,37 @@ bool Server::isValidUsername(string username) {
 	return regex_search(username, matches, allowedUsernameChars);
 }
 
-/* Sees if the user is registered. */
+/* Sees if the user is registered.
+	Whether the registry is loaded is read before looking in it, a miss only means the name is free if the load had already finished when the lookup started.
+*/
 bool Server::doesRegisteredUsernameExist(string username) {
 	if(!isValidUsername(username))
 		return false;
 	transform(username.begin(), username.end(), username.begin(), ::tolower);
-	ifstream saveFile;
-	saveFile.open(SAVE_DIRECTORY + username + ".txt");
-	bool exists = saveFile.is_open();
-	saveFile.close();
-	return exists;
+	bool registryLoaded = usernameRegistry.isLoaded();
+	string canonicalName;
+	if(usernameRegistry.find(username, canonicalName))
+		return true;
+	if(registryLoaded)
+		return false;
+	UserRecord record; //Still loading the registry.
+	return persister.findPending(username, record) || userStore.exists(username);
 }
 
-/* Checks to see if the username is registered by attempting to load the user save file, and if so returns the proper case of that username. Otherwise returns an empty string. */
+/* Checks to see if the username is registered, and if so returns the proper case of that username. Otherwise returns an empty string.
+	See doesRegisteredUsernameExist() for why the registry's load state is read first.
+*/
 string Server::getProperUsernameCase(string username) {
 	transform(username.begin(), username.end(), username.begin(), ::tolower);
-	ifstream userFile;
-	try {
-		userFile.open(SAVE_DIRECTORY + username + ".txt");
-		if(userFile.is_open()) {
-			string properName;
-			unsigned short version = 0;
-			userFile >> version;
-			switch(version) {
-				case 2:
-					userFile >> properName;
-					break;
-				default:
-					throw exception("Unsupported file version");
-			}
-			userFile.close();
-			return properName;
-		} else {
-			return "";
-		}
-	} catch(exception e) {
-		cout << "Failure loading " << username << "'s proper username from save: " << e.what();
-	}
+	bool registryLoaded = usernameRegistry.isLoaded();
+	string canonicalName;
+	if(usernameRegistry.find(username, canonicalName))
+		return canonicalName;
+	if(registryLoaded)
+		return "";
+	UserRecord record; //Still loading the registry.
+	if(findUserRecord(username, record))
+		return record.name;
 	return "";
 }
 
@@ -273,6 +724,13 @@ void Server::log(string line) {
 }
 
 Server::~Server() {
+	listening = false;
+	if(tickThreadInstance.joinable())
+		tickThreadInstance.join();
+	deleteRetired();
+	sessionSnapshotter.submit(captureSessionSnapshot());
+	if(registryThreadInstance.joinable())
+		registryThreadInstance.join();
 	if(sSocket != INVALID_SOCKET) {
 		closesocket(sSocket);
 	}
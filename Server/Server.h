@@ -6,36 +6,124 @@
 #include <Ws2tcpip.h>
 #include <regex>
 #include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include "UserTable.h"
+#include "SymbolTable.h"
+#include "Packet/FrameCache.h"
+#include "Storage/UserPersister.h"
+#include "Storage/ProfileCache.h"
+#include "Storage/OfflineSpool.h"
+#include "Storage/ChatArchive.h"
+#include "Storage/ChatExporter.h"
+#include "Storage/SessionSnapshot.h"
+#include "UsernameRegistry.h"
 class User;
+class Friend;
 class Room;
 
+/* A single change to the server's room list, sent to clients in batches. */
+struct RoomListDelta {
+	unsigned short type;
+	std::string name;
+	unsigned short userCount;
+};
+
+/* A friend presence change waiting out the debounce period before it is announced. Holds a reference to the name symbol until then. */
+struct PresenceChange {
+	SymbolId nameId;
+	bool online;
+	bool announced;
+	std::chrono::steady_clock::time_point lastChange;
+};
+
 class Server {
 public:
 	Server(unsigned int port);
 	~Server();
 	bool start();
 	void doListen();
+	void tickLoop();
+	void loadUsernameRegistry();
 	void removeUser(User* const user);
 	User** const getUserList();
+	UserTable& getUserTable();
+	SymbolTable& getSymbolTable();
+	FrameCache& getFrameCache();
+	UserPersister& getPersister();
+	UserStore& getUserStore();
+	UsernameRegistry& getUsernameRegistry();
+	OfflineSpool& getOfflineSpool();
+	ChatArchive& getChatArchive();
+	ChatExporter& getChatExporter();
+	bool findUserRecord(const std::string& lowercaseName, UserRecord& record);
+	void saveUserRecord(const std::string& lowercaseName, const UserRecord& record);
 	User* const getUserByName(std::string name);
+	User* const getUserBySymbol(SymbolId foldedNameId);
 	Room** const getRoomList();
 	Room* const makeRoom(User* owner, std::string roomName);
 	void destroyRoom(Room* room);
+	void joinOrMakeRoom(User* const user, std::string roomName);
 	void handleFriendStatusUpdate(User* const user);
-	void updateRoomList();
+	void flushPresenceChanges();
+	void addFriendReference(User* const user, Friend* const friendEntry);
+	void removeFriendReference(User* const user, Friend* const friendEntry);
+	void queueRoomListDelta(unsigned short type, Room* const room);
+	void flushRoomListDeltas();
 	void updateRoomList(User* const user);
+	void writeRoomList(Packet& p);
 	bool doesRegisteredUsernameExist(std::string username);
 	std::string getProperUsernameCase(std::string username);
+	std::string issueResumeToken(User* const user);
+	void keepResumableSession(User* const user);
+	bool findResumableSession(const std::string& token, std::string username, std::string& roomName);
+	bool consumeResumableSession(const std::string& token);
+	void markSessionsChanged();
+	unsigned short spoolOfflineMessage(User* const from, std::string recipientName, const std::string& message);
 	bool isValidUsername(std::string username);
 	void log(std::string line);
 private:
+	void deleteRetired();
+	void loadSessionSnapshot();
+	std::shared_ptr<const ServerSnapshot> captureSessionSnapshot();
 	unsigned short roomCount;
 	unsigned int port;
 	SOCKET sSocket;
 	bool listening;
+	SymbolTable symbolTable;
 	Room* roomList[MAX_ROOMS];
 	User* userList[MAX_USERS];
+	UserTable userTable;
+	FrameCache frameCache;
+	UserStore userStore;
+	UserPersister persister;
+	UsernameRegistry usernameRegistry;
+	ProfileCache profileCache;
+	OfflineSpool offlineSpool;
+	ChatArchive chatArchive;
+	ChatExporter chatExporter;
+	SessionSnapshotter sessionSnapshotter;
+	std::unordered_map<std::string, SnapshotSession> resumableSessions;
+	std::mutex sessionMutex;
+	std::atomic<bool> sessionsChanged;
+	std::thread registryThreadInstance;
 	std::regex allowedUsernameChars;
 	std::ofstream logFile;
+	std::unordered_map<SymbolId, std::unordered_map<User*, Friend*>> friendedBy;
+	std::mutex friendIndexMutex;
+	unsigned int roomListVersion;
+	std::vector<RoomListDelta> pendingRoomListDeltas;
+	std::mutex roomListMutex;
+	std::thread tickThreadInstance;
+	std::vector<User*> retiredUsers;
+	std::vector<Room*> retiredRooms;
+	std::mutex retiredMutex;
+	std::unordered_map<SymbolId, PresenceChange> pendingPresence;
+	std::mutex presenceMutex;
 };
 #endif //SERVER_H_
\ No newline at end of file
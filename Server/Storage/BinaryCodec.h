@@ -0,0 +1,111 @@
+#ifndef BINARY_CODEC_H_
+#define BINARY_CODEC_H_
+#include <string>
+#include <exception>
+
+/* Appends big endian values to a string, in the same byte order DataStream uses on the wire. */
+class BinaryWriter {
+public:
+	BinaryWriter(std::string& out) : out(out) {}
+	void putByte(unsigned char value) {
+		out += (char)value;
+	}
+	void putShort(unsigned short value) {
+		out += (char)((value >> 8) & 0xFF);
+		out += (char)(value & 0xFF);
+	}
+	void putInt(unsigned int value) {
+		putShort((unsigned short)(value >> 16));
+		putShort((unsigned short)(value & 0xFFFF));
+	}
+	void putLong(unsigned long long value) {
+		putInt((unsigned int)(value >> 32));
+		putInt((unsigned int)(value & 0xFFFFFFFF));
+	}
+	void putString(const std::string& value) {
+		putShort((unsigned short)value.size());
+		out += value;
+	}
+	void putVarint(unsigned long long value) {
+		while(value >= 0x80) {
+			out += (char)((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+		out += (char)value;
+	}
+	void putBytes(const std::string& value) {
+		out += value;
+	}
+private:
+	std::string& out;
+};
+
+/* Reads values written by BinaryWriter back out of a buffer, throwing if a value runs past the end of it. */
+class BinaryReader {
+public:
+	BinaryReader(const char* data, size_t size) : data(data), size(size), position(0) {}
+	unsigned char getByte() {
+		require(1);
+		return (unsigned char)data[position++];
+	}
+	unsigned short getShort() {
+		unsigned short high = getByte();
+		return (unsigned short)((high << 8) | getByte());
+	}
+	unsigned int getInt() {
+		unsigned int high = getShort();
+		return (high << 16) | getShort();
+	}
+	unsigned long long getLong() {
+		unsigned long long high = getInt();
+		return (high << 32) | getInt();
+	}
+	std::string getString() {
+		unsigned short length = getShort();
+		require(length);
+		std::string value(data + position, length);
+		position += length;
+		return value;
+	}
+	unsigned long long getVarint() {
+		unsigned long long value = 0;
+		for(unsigned int shift = 0; shift < 64; shift += 7) {
+			unsigned char byte = getByte();
+			value |= (unsigned long long)(byte & 0x7F) << shift;
+			if(!(byte & 0x80))
+				return value;
+		}
+		throw std::exception("Varint too long");
+	}
+	const char* getBytes(size_t length) {
+		require(length);
+		const char* bytes = data + position;
+		position += length;
+		return bytes;
+	}
+	size_t getPosition() const {
+		return position;
+	}
+	bool atEnd() const {
+		return position >= size;
+	}
+private:
+	void require(size_t amount) {
+		if(size - position < amount)
+			throw std::exception("Record ended early");
+	}
+	const char* data;
+	size_t size;
+	size_t position;
+};
+
+/* FNV-1a hash of a block of bytes, used to spot torn or corrupted records. */
+inline unsigned int checksum(const char* data, size_t size) {
+	unsigned int hash = 2166136261u;
+	for(size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+#endif //BINARY_CODEC_H_
@@ -0,0 +1,271 @@
+#include "ChatArchive.h"
+#include "BinaryCodec.h"
+#include <windows.h>
+#include <io.h>
+#include <share.h>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <chrono>
+#include <utility>
+using namespace std;
+
+#define ARCHIVE_RECORD_HEADER_LENGTH 8
+
+/* Encodes a message as [payload length][checksum][payload]. */
+static string encodeRecord(const ArchivedMessage& message) {
+	string payload;
+	BinaryWriter writer(payload);
+	writer.putLong(message.id);
+	writer.putLong((unsigned long long)message.time);
+	writer.putString(message.sender);
+	writer.putString(message.text);
+	string frame;
+	BinaryWriter header(frame);
+	header.putInt((unsigned int)payload.size());
+	header.putInt(checksum(payload.data(), payload.size()));
+	return frame + payload;
+}
+
+/* Decodes a record written by encodeRecord(), returns false if it is torn or corrupted. */
+static bool decodeRecord(const char* frame, size_t available, ArchivedMessage& message, unsigned int& length) {
+	try {
+		if(available < ARCHIVE_RECORD_HEADER_LENGTH)
+			return false;
+		BinaryReader header(frame, ARCHIVE_RECORD_HEADER_LENGTH);
+		unsigned int payloadLength = header.getInt();
+		unsigned int expected = header.getInt();
+		if(available - ARCHIVE_RECORD_HEADER_LENGTH < payloadLength)
+			return false;
+		const char* payload = frame + ARCHIVE_RECORD_HEADER_LENGTH;
+		if(checksum(payload, payloadLength) != expected)
+			return false;
+		BinaryReader reader(payload, payloadLength);
+		message.id = reader.getLong();
+		message.time = (long long)reader.getLong();
+		message.sender = reader.getString();
+		message.text = reader.getString();
+		length = ARCHIVE_RECORD_HEADER_LENGTH + payloadLength;
+		return true;
+	} catch(exception&) {
+		return false;
+	}
+}
+
+ChatArchive::ChatArchive(const string& directory) :
+	directory(directory),
+	nextId(0),
+	loaded(false),
+	running(true) {
+	archiveThreadInstance = thread(&ChatArchive::archiveLoop, this);
+}
+
+ChatArchive::~ChatArchive() {
+	mtx.lock();
+	running = false;
+	mtx.unlock();
+	wake.notify_one();
+	if(archiveThreadInstance.joinable())
+		archiveThreadInstance.join();
+}
+
+/* Queues a room message to be archived on the next pass of the archive thread. */
+void ChatArchive::append(const string& roomName, const string& sender, const string& text) {
+	lock_guard<mutex> lock(mtx);
+	queued.push_back({roomName, (long long)time(nullptr), sender, text});
+}
+
+/* Finds the newest ARCHIVE_SEARCH_RESULTS messages in the room containing every term, oldest first.
+	Returns false if nothing has ever been archived for the room.
+*/
+bool ChatArchive::search(const string& roomName, const string& terms, vector<ArchivedMessage>& results) {
+	string key = roomKey(roomName);
+	vector<ArchiveLocation> locations;
+	indexMutex.lock();
+	auto it = rooms.find(key);
+	if(it == rooms.end()) {
+		indexMutex.unlock();
+		return false;
+	}
+	vector<unsigned int> matches = it->second.index.find(InvertedIndex::tokenize(terms));
+	size_t first = matches.size() > ARCHIVE_SEARCH_RESULTS ? matches.size() - ARCHIVE_SEARCH_RESULTS : 0;
+	for(size_t i = first; i < matches.size(); i++) {
+		locations.push_back(it->second.locations[matches[i]]);
+	}
+	indexMutex.unlock();
+	for(const ArchiveLocation& location : locations) {
+		ArchivedMessage message;
+		if(readMessage(key, location, message))
+			results.push_back(message);
+	}
+	return true;
+}
+
+/* Returns true once the index has been rebuilt from the segments left by earlier runs. */
+bool ChatArchive::isLoaded() {
+	lock_guard<mutex> lock(indexMutex);
+	return loaded;
+}
+
+/* Formats an archive timestamp in local time, as year-month-day hour:minute. */
+string ChatArchive::formatTime(long long time) {
+	time_t seconds = (time_t)time;
+	tm local;
+	if(localtime_s(&local, &seconds) != 0)
+		return "?";
+	char formatted[32];
+	strftime(formatted, sizeof(formatted), "%Y-%m-%d %H:%M", &local);
+	return formatted;
+}
+
+/* Rebuilds the index, then writes and indexes the queued messages every ARCHIVE_FLUSH_MS until stopped, writing whatever is left before returning. */
+void ChatArchive::archiveLoop() {
+	rebuild();
+	unique_lock<mutex> lock(mtx);
+	while(running || !queued.empty()) {
+		wake.wait_for(lock, chrono::milliseconds(ARCHIVE_FLUSH_MS), [this]() { return !running; });
+		if(queued.empty())
+			continue;
+		vector<QueuedMessage> batch;
+		batch.swap(queued);
+		lock.unlock();
+		writeBatch(batch);
+		lock.lock();
+	}
+}
+
+/* Reads every segment left from earlier runs back into the index, oldest partition first so message numbers stay in time order.
+	A torn record at the end of a segment is cut off so nothing is appended after it.
+*/
+void ChatArchive::rebuild() {
+	vector<pair<string, unsigned int>> segments;
+	WIN32_FIND_DATAA findData;
+	HANDLE search = FindFirstFileA((directory + "*.seg").c_str(), &findData);
+	if(search != INVALID_HANDLE_VALUE) {
+		do {
+			if(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+			string baseName = findData.cFileName;
+			baseName = baseName.substr(0, baseName.length() - 4);
+			size_t dotPos = baseName.rfind('.');
+			if(dotPos == string::npos)
+				continue;
+			try {
+				segments.push_back(make_pair(baseName.substr(0, dotPos), (unsigned int)stoul(baseName.substr(dotPos + 1))));
+			} catch(exception&) {
+			}
+		} while(FindNextFileA(search, &findData));
+		FindClose(search);
+	}
+	sort(segments.begin(), segments.end());
+	for(const auto& segment : segments) {
+		if(!running)
+			break;
+		string path = segmentPath(segment.first, segment.second);
+		ifstream segmentFile(path, ios::binary);
+		if(!segmentFile.is_open())
+			continue;
+		string data((istreambuf_iterator<char>(segmentFile)), istreambuf_iterator<char>());
+		segmentFile.close();
+		size_t offset = 0;
+		ArchivedMessage message;
+		unsigned int length = 0;
+		lock_guard<mutex> lock(indexMutex);
+		ArchiveRoom& room = rooms[segment.first];
+		room.key = segment.first;
+		while(decodeRecord(data.data() + offset, data.size() - offset, message, length)) {
+			room.index.add((unsigned int)room.locations.size(), message.text);
+			room.locations.push_back({segment.second, (unsigned int)offset});
+			nextId = max(nextId, message.id + 1);
+			offset += length;
+		}
+		if(offset < data.size()) {
+			FILE* tornFile = _fsopen(path.c_str(), "r+b", _SH_DENYNO);
+			if(tornFile != nullptr) {
+				_chsize_s(_fileno(tornFile), offset);
+				fclose(tornFile);
+			}
+		}
+	}
+	lock_guard<mutex> lock(indexMutex);
+	loaded = true;
+}
+
+/* Appends the batch to the segments, then indexes the messages that were written. Each segment touched is opened once for the batch and flushed at the end. */
+void ChatArchive::writeBatch(const vector<QueuedMessage>& batch) {
+	unordered_map<string, pair<unsigned int, FILE*>> openSegments;
+	vector<pair<size_t, ArchiveLocation>> written;
+	for(size_t i = 0; i < batch.size(); i++) {
+		const QueuedMessage& queuedMessage = batch[i];
+		string key = roomKey(queuedMessage.roomName);
+		unsigned int partition = (unsigned int)(queuedMessage.time / ARCHIVE_SEGMENT_SECONDS);
+		auto it = openSegments.find(key);
+		if(it != openSegments.end() && it->second.first != partition) {
+			fclose(it->second.second);
+			openSegments.erase(it);
+			it = openSegments.end();
+		}
+		if(it == openSegments.end()) {
+			FILE* segmentFile = _fsopen(segmentPath(key, partition).c_str(), "ab", _SH_DENYNO);
+			if(segmentFile == nullptr)
+				continue;
+			fseek(segmentFile, 0, SEEK_END);
+			it = openSegments.emplace(key, make_pair(partition, segmentFile)).first;
+		}
+		ArchivedMessage message = {nextId++, queuedMessage.time, queuedMessage.sender, queuedMessage.text};
+		string record = encodeRecord(message);
+		unsigned int offset = (unsigned int)ftell(it->second.second);
+		if(fwrite(record.data(), 1, record.size(), it->second.second) != record.size())
+			continue;
+		written.push_back(make_pair(i, ArchiveLocation{partition, offset}));
+	}
+	for(auto& segment : openSegments) {
+		fflush(segment.second.second);
+		fclose(segment.second.second);
+	}
+	lock_guard<mutex> lock(indexMutex);
+	for(const auto& entry : written) {
+		string key = roomKey(batch[entry.first].roomName);
+		ArchiveRoom& room = rooms[key];
+		room.key = key;
+		room.index.add((unsigned int)room.locations.size(), batch[entry.first].text);
+		room.locations.push_back(entry.second);
+	}
+}
+
+/* Reads a single archived message from its segment. */
+bool ChatArchive::readMessage(const string& key, const ArchiveLocation& location, ArchivedMessage& message) {
+	ifstream segmentFile(segmentPath(key, location.partition), ios::binary);
+	if(!segmentFile.is_open())
+		return false;
+	char header[ARCHIVE_RECORD_HEADER_LENGTH];
+	segmentFile.seekg(location.offset);
+	if(!segmentFile.read(header, ARCHIVE_RECORD_HEADER_LENGTH))
+		return false;
+	unsigned int payloadLength = BinaryReader(header, ARCHIVE_RECORD_HEADER_LENGTH).getInt();
+	string record(header, ARCHIVE_RECORD_HEADER_LENGTH);
+	record.resize(ARCHIVE_RECORD_HEADER_LENGTH + payloadLength);
+	if(!segmentFile.read(&record[ARCHIVE_RECORD_HEADER_LENGTH], payloadLength))
+		return false;
+	unsigned int length = 0;
+	return decodeRecord(record.data(), record.size(), message, length);
+}
+
+/* Returns the path of one of a room's segment files. */
+string ChatArchive::segmentPath(const string& key, unsigned int partition) {
+	return directory + key + "." + to_string(partition) + ".seg";
+}
+
+/* Room names can hold any character, so segments are named after the hex of the lowercase name instead. */
+string ChatArchive::roomKey(string roomName) {
+	static const char hexDigits[] = "0123456789abcdef";
+	transform(roomName.begin(), roomName.end(), roomName.begin(), ::tolower);
+	string key;
+	for(unsigned char c : roomName) {
+		key += hexDigits[c >> 4];
+		key += hexDigits[c & 0x0F];
+	}
+	return key;
+}
@@ -0,0 +1,69 @@
+#ifndef CHAT_ARCHIVE_H_
+#define CHAT_ARCHIVE_H_
+#include "../Constants.h"
+#include "InvertedIndex.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* A room message as it is kept in the archive. */
+struct ArchivedMessage {
+	unsigned long long id;
+	long long time;
+	std::string sender;
+	std::string text;
+};
+
+/* Where an archived message sits on disk. */
+struct ArchiveLocation {
+	unsigned int partition;
+	unsigned int offset;
+};
+
+/* A room's searchable history, messages are numbered by their position in locations. */
+struct ArchiveRoom {
+	std::string key;
+	InvertedIndex index;
+	std::vector<ArchiveLocation> locations;
+};
+
+/* Keeps every room message in segment files, one per room for each ARCHIVE_SEGMENT_SECONDS of time, along with an inverted index to search them.
+	Appending only queues the message, a background thread writes the queue to the segments every ARCHIVE_FLUSH_MS and then indexes what it wrote.
+	At startup the same thread rebuilds the index from the segments before it takes on new messages, searches meanwhile only see what's been indexed so far.
+*/
+class ChatArchive {
+public:
+	ChatArchive(const std::string& directory);
+	~ChatArchive();
+	void append(const std::string& roomName, const std::string& sender, const std::string& text);
+	bool search(const std::string& roomName, const std::string& terms, std::vector<ArchivedMessage>& results);
+	bool isLoaded();
+	static std::string formatTime(long long time);
+	void archiveLoop();
+private:
+	struct QueuedMessage {
+		std::string roomName;
+		long long time;
+		std::string sender;
+		std::string text;
+	};
+	void rebuild();
+	void writeBatch(const std::vector<QueuedMessage>& batch);
+	bool readMessage(const std::string& key, const ArchiveLocation& location, ArchivedMessage& message);
+	std::string segmentPath(const std::string& key, unsigned int partition);
+	static std::string roomKey(std::string roomName);
+	const std::string directory;
+	unsigned long long nextId;
+	std::unordered_map<std::string, ArchiveRoom> rooms;
+	bool loaded;
+	std::mutex indexMutex;
+	std::vector<QueuedMessage> queued;
+	std::mutex mtx;
+	std::condition_variable wake;
+	bool running;
+	std::thread archiveThreadInstance;
+};
+#endif //CHAT_ARCHIVE_H_
@@ -0,0 +1,86 @@
+#include "ChatExporter.h"
+#include <windows.h>
+#include <io.h>
+#include <share.h>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+using namespace std;
+
+ChatExporter::ChatExporter(const string& directory) :
+	directory(directory),
+	runId(to_string((long long)time(nullptr))),
+	running(true) {
+	exportThreadInstance = thread(&ChatExporter::exportLoop, this);
+}
+
+ChatExporter::~ChatExporter() {
+	mtx.lock();
+	running = false;
+	mtx.unlock();
+	wake.notify_one();
+	if(exportThreadInstance.joinable())
+		exportThreadInstance.join();
+}
+
+/* Queues an event to be exported with the next block. */
+void ChatExporter::append(unsigned char type, const string& room, const string& user, const string& text) {
+	lock_guard<mutex> lock(mtx);
+	if(pending.empty())
+		oldestPending = chrono::steady_clock::now();
+	pending.push_back({(long long)time(nullptr), room, user, type, text});
+	if(pending.size() >= EXPORT_BLOCK_ROWS)
+		wake.notify_one();
+}
+
+/* Writes a block whenever enough events have built up or the oldest has waited long enough, and writes whatever is left when stopped. */
+void ChatExporter::exportLoop() {
+	unique_lock<mutex> lock(mtx);
+	while(running || !pending.empty()) {
+		wake.wait_for(lock, chrono::milliseconds(EXPORT_FLUSH_MS), [this]() { return !running || pending.size() >= EXPORT_BLOCK_ROWS; });
+		if(pending.empty())
+			continue;
+		if(running && pending.size() < EXPORT_BLOCK_ROWS && chrono::steady_clock::now() - oldestPending < chrono::milliseconds(EXPORT_BLOCK_MAX_MS))
+			continue;
+		vector<ExportRow> rows;
+		rows.swap(pending);
+		lock.unlock();
+		writeRows(rows);
+		lock.lock();
+	}
+}
+
+/* Appends the rows to the export files as blocks, starting a new block wherever the day changes so every block belongs to one day's file. */
+void ChatExporter::writeRows(const vector<ExportRow>& rows) {
+	size_t start = 0;
+	while(start < rows.size()) {
+		string day = dayOf(rows[start].time);
+		size_t end = start + 1;
+		while(end < rows.size() && dayOf(rows[end].time) == day) {
+			end++;
+		}
+		string block = encodeColumnBlock(vector<ExportRow>(rows.begin() + start, rows.begin() + end));
+		string path = directory + "events." + day + "." + runId + ".col";
+		FILE* exportFile = _fsopen(path.c_str(), "ab", _SH_DENYNO);
+		if(exportFile == nullptr) {
+			cout << "Failure opening " << path << ", " << (end - start) << " events weren't exported." << endl;
+		} else {
+			fwrite(block.data(), 1, block.size(), exportFile);
+			fflush(exportFile);
+			_commit(_fileno(exportFile));
+			fclose(exportFile);
+		}
+		start = end;
+	}
+}
+
+/* Returns the local date of a time as yyyymmdd. */
+string ChatExporter::dayOf(long long time) {
+	time_t seconds = (time_t)time;
+	tm local;
+	if(localtime_s(&local, &seconds) != 0)
+		return "00000000";
+	char formatted[16];
+	strftime(formatted, sizeof(formatted), "%Y%m%d", &local);
+	return formatted;
+}
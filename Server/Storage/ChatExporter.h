@@ -0,0 +1,34 @@
+#ifndef CHAT_EXPORTER_H_
+#define CHAT_EXPORTER_H_
+#include "../Constants.h"
+#include "ColumnarFormat.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/* Exports chat and command events for analysis in the columnar format read by the LogQuery tool.
+	Events are queued in memory and a background thread writes them out as a block once EXPORT_BLOCK_ROWS have built up or the oldest has waited EXPORT_BLOCK_MAX_MS.
+	Each day gets its own file per server run (events.[date].[run].col), so a crash can only tear the end of the current run's file.
+*/
+class ChatExporter {
+public:
+	ChatExporter(const std::string& directory);
+	~ChatExporter();
+	void append(unsigned char type, const std::string& room, const std::string& user, const std::string& text);
+	void exportLoop();
+private:
+	void writeRows(const std::vector<ExportRow>& rows);
+	static std::string dayOf(long long time);
+	const std::string directory;
+	const std::string runId;
+	std::vector<ExportRow> pending;
+	std::chrono::steady_clock::time_point oldestPending;
+	std::mutex mtx;
+	std::condition_variable wake;
+	bool running;
+	std::thread exportThreadInstance;
+};
+#endif //CHAT_EXPORTER_H_
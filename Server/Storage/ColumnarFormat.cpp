@@ -0,0 +1,191 @@
+#include "ColumnarFormat.h"
+#include "BinaryCodec.h"
+#include <unordered_map>
+#include <algorithm>
+using namespace std;
+
+/* Maps a signed difference to an unsigned one so small steps either way stay small varints. */
+static unsigned long long zigzag(long long value) {
+	return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+/* Reverses zigzag(). */
+static long long unzigzag(unsigned long long value) {
+	return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+/* Returns the value's index in the dictionary, adding it if it isn't there yet. */
+static unsigned int dictionaryIndex(vector<string>& dictionary, unordered_map<string, unsigned int>& lookup, const string& value) {
+	auto it = lookup.find(value);
+	if(it != lookup.end())
+		return it->second;
+	lookup[value] = (unsigned int)dictionary.size();
+	dictionary.push_back(value);
+	return (unsigned int)dictionary.size() - 1;
+}
+
+string encodeColumnBlock(const vector<ExportRow>& rows) {
+	BlockStats stats = {(unsigned int)rows.size(), 0, 0, 0};
+	unordered_map<string, unsigned int> roomLookup;
+	unordered_map<string, unsigned int> userLookup;
+	string columns[COLUMN_COUNT];
+	BinaryWriter times(columns[COLUMN_TIME]);
+	BinaryWriter rooms(columns[COLUMN_ROOM]);
+	BinaryWriter users(columns[COLUMN_USER]);
+	BinaryWriter types(columns[COLUMN_TYPE]);
+	BinaryWriter texts(columns[COLUMN_TEXT]);
+	if(!rows.empty()) {
+		stats.minTime = stats.maxTime = rows[0].time;
+		for(const ExportRow& row : rows) {
+			stats.minTime = min(stats.minTime, row.time);
+			stats.maxTime = max(stats.maxTime, row.time);
+		}
+	}
+	long long previousTime = stats.minTime;
+	for(const ExportRow& row : rows) {
+		times.putVarint(zigzag(row.time - previousTime));
+		previousTime = row.time;
+		rooms.putVarint(dictionaryIndex(stats.rooms, roomLookup, row.room));
+		users.putVarint(dictionaryIndex(stats.users, userLookup, row.user));
+		types.putByte(row.type);
+		stats.typeMask |= (unsigned char)(1 << row.type);
+		texts.putVarint(row.text.size());
+		texts.putBytes(row.text);
+	}
+	string payload;
+	BinaryWriter writer(payload);
+	writer.putVarint(stats.rowCount);
+	writer.putLong((unsigned long long)stats.minTime);
+	writer.putLong((unsigned long long)stats.maxTime);
+	writer.putByte(stats.typeMask);
+	writer.putVarint(stats.rooms.size());
+	for(const string& room : stats.rooms) {
+		writer.putString(room);
+	}
+	writer.putVarint(stats.users.size());
+	for(const string& user : stats.users) {
+		writer.putString(user);
+	}
+	for(unsigned short i = 0; i < COLUMN_COUNT; i++) {
+		writer.putVarint(columns[i].size());
+		writer.putBytes(columns[i]);
+	}
+	string block;
+	BinaryWriter header(block);
+	header.putInt(COLUMN_BLOCK_MAGIC);
+	header.putInt((unsigned int)payload.size());
+	header.putInt(checksum(payload.data(), payload.size()));
+	return block + payload;
+}
+
+/* Reads the block's header and stats and finds where each column starts, without decoding or checksumming the columns.
+	Sets length to the size of the whole block. Returns false if there is no complete block at data, the end of a file torn by a crash.
+*/
+bool ColumnBlock::open(const char* data, size_t available, size_t& length) {
+	try {
+		if(available < COLUMN_BLOCK_HEADER_LENGTH)
+			return false;
+		BinaryReader header(data, COLUMN_BLOCK_HEADER_LENGTH);
+		if(header.getInt() != COLUMN_BLOCK_MAGIC)
+			return false;
+		payloadLength = header.getInt();
+		expectedChecksum = header.getInt();
+		if(available - COLUMN_BLOCK_HEADER_LENGTH < payloadLength)
+			return false;
+		payload = data + COLUMN_BLOCK_HEADER_LENGTH;
+		BinaryReader reader(payload, payloadLength);
+		stats.rowCount = (unsigned int)reader.getVarint();
+		stats.minTime = (long long)reader.getLong();
+		stats.maxTime = (long long)reader.getLong();
+		stats.typeMask = reader.getByte();
+		unsigned long long roomCount = reader.getVarint();
+		if(roomCount > payloadLength) //A corrupted count, each entry takes at least a byte.
+			return false;
+		stats.rooms.resize((size_t)roomCount);
+		for(string& room : stats.rooms) {
+			room = reader.getString();
+		}
+		unsigned long long userCount = reader.getVarint();
+		if(userCount > payloadLength)
+			return false;
+		stats.users.resize((size_t)userCount);
+		for(string& user : stats.users) {
+			user = reader.getString();
+		}
+		for(unsigned short i = 0; i < COLUMN_COUNT; i++) {
+			columnLengths[i] = (size_t)reader.getVarint();
+			columns[i] = reader.getBytes(columnLengths[i]);
+		}
+		length = COLUMN_BLOCK_HEADER_LENGTH + payloadLength;
+		return true;
+	} catch(exception&) {
+		return false;
+	}
+}
+
+/* Checks the whole payload against the block's checksum, done only for blocks a query actually reads. */
+bool ColumnBlock::verify() const {
+	return checksum(payload, payloadLength) == expectedChecksum;
+}
+
+/* Returns the stats read by open(). */
+const BlockStats& ColumnBlock::getStats() const {
+	return stats;
+}
+
+/* Decodes the time column back into absolute times. */
+vector<long long> ColumnBlock::readTimes() const {
+	vector<long long> values;
+	values.reserve(stats.rowCount);
+	BinaryReader reader(columns[COLUMN_TIME], columnLengths[COLUMN_TIME]);
+	long long time = stats.minTime;
+	for(unsigned int i = 0; i < stats.rowCount; i++) {
+		time += unzigzag(reader.getVarint());
+		values.push_back(time);
+	}
+	return values;
+}
+
+/* Returns each row's index into the room dictionary. */
+vector<unsigned int> ColumnBlock::readRooms() const {
+	return readIndexes(COLUMN_ROOM);
+}
+
+/* Returns each row's index into the user dictionary. */
+vector<unsigned int> ColumnBlock::readUsers() const {
+	return readIndexes(COLUMN_USER);
+}
+
+/* Returns the event type column, stored as one byte per row. */
+vector<unsigned char> ColumnBlock::readTypes() const {
+	if(columnLengths[COLUMN_TYPE] < stats.rowCount)
+		throw exception("Type column ended early");
+	return vector<unsigned char>((const unsigned char*)columns[COLUMN_TYPE], (const unsigned char*)columns[COLUMN_TYPE] + stats.rowCount);
+}
+
+/* Decodes the text column. */
+vector<string> ColumnBlock::readTexts() const {
+	vector<string> values;
+	values.reserve(stats.rowCount);
+	BinaryReader reader(columns[COLUMN_TEXT], columnLengths[COLUMN_TEXT]);
+	for(unsigned int i = 0; i < stats.rowCount; i++) {
+		size_t length = (size_t)reader.getVarint();
+		values.push_back(string(reader.getBytes(length), length));
+	}
+	return values;
+}
+
+/* Decodes a dictionary column, throwing if an index is outside the block's dictionary. */
+vector<unsigned int> ColumnBlock::readIndexes(unsigned short column) const {
+	size_t dictionarySize = column == COLUMN_ROOM ? stats.rooms.size() : stats.users.size();
+	vector<unsigned int> values;
+	values.reserve(stats.rowCount);
+	BinaryReader reader(columns[column], columnLengths[column]);
+	for(unsigned int i = 0; i < stats.rowCount; i++) {
+		unsigned long long index = reader.getVarint();
+		if(index >= dictionarySize)
+			throw exception("Dictionary index out of range");
+		values.push_back((unsigned int)index);
+	}
+	return values;
+}
@@ -0,0 +1,64 @@
+#ifndef COLUMNAR_FORMAT_H_
+#define COLUMNAR_FORMAT_H_
+#include <string>
+#include <vector>
+#define COLUMN_BLOCK_MAGIC 0x44434F4C
+#define COLUMN_BLOCK_HEADER_LENGTH 12
+#define COLUMN_TIME 0
+#define COLUMN_ROOM 1
+#define COLUMN_USER 2
+#define COLUMN_TYPE 3
+#define COLUMN_TEXT 4
+#define COLUMN_COUNT 5
+#define EXPORT_EVENT_CHAT 0
+#define EXPORT_EVENT_COMMAND 1
+#define EXPORT_EVENT_TYPES 2
+
+/* A single exported event. room is empty for commands used outside a room. */
+struct ExportRow {
+	long long time;
+	std::string room;
+	std::string user;
+	unsigned char type;
+	std::string text;
+};
+
+/* What a block holds, stored ahead of its columns so a query can rule out the whole block without decoding any of them.
+	The room and user dictionaries double as the set of every room and user in the block.
+*/
+struct BlockStats {
+	unsigned int rowCount;
+	long long minTime;
+	long long maxTime;
+	unsigned char typeMask;
+	std::vector<std::string> rooms;
+	std::vector<std::string> users;
+};
+
+/* Encodes rows as one self contained block: [magic][payload length][checksum][payload].
+	The payload is the block stats followed by each column as [byte length][data], so a reader can skip straight past columns it doesn't need.
+	Times are varint differences from the previous row (zigzag encoded, the clock can step back), rooms and users are indexes into the dictionaries and texts are length prefixed.
+*/
+std::string encodeColumnBlock(const std::vector<ExportRow>& rows);
+
+/* Reads a block written by encodeColumnBlock() straight out of a buffer, decoding columns only when asked for them. */
+class ColumnBlock {
+public:
+	bool open(const char* data, size_t available, size_t& length);
+	bool verify() const;
+	const BlockStats& getStats() const;
+	std::vector<long long> readTimes() const;
+	std::vector<unsigned int> readRooms() const;
+	std::vector<unsigned int> readUsers() const;
+	std::vector<unsigned char> readTypes() const;
+	std::vector<std::string> readTexts() const;
+private:
+	std::vector<unsigned int> readIndexes(unsigned short column) const;
+	BlockStats stats;
+	const char* payload;
+	size_t payloadLength;
+	unsigned int expectedChecksum;
+	const char* columns[COLUMN_COUNT];
+	size_t columnLengths[COLUMN_COUNT];
+};
+#endif //COLUMNAR_FORMAT_H_
@@ -0,0 +1,88 @@
+#include "InvertedIndex.h"
+#include "../Constants.h"
+#include <algorithm>
+#include <iterator>
+#include <cctype>
+using namespace std;
+
+/* Adds a message under every distinct token in its text. Message numbers must only ever increase. */
+void InvertedIndex::add(unsigned int messageNumber, const string& text) {
+	for(const string& token : tokenize(text)) {
+		auto it = postings.find(token);
+		if(it == postings.end())
+			it = postings.emplace(token, PostingList{"", 0, 0}).first;
+		PostingList& list = it->second;
+		if(list.count > 0 && list.last == messageNumber)
+			continue;
+		unsigned int delta = messageNumber - list.last;
+		while(delta >= 0x80) {
+			list.deltas += (char)((delta & 0x7F) | 0x80);
+			delta >>= 7;
+		}
+		list.deltas += (char)delta;
+		list.last = messageNumber;
+		list.count++;
+	}
+}
+
+/* Returns the messages containing every one of the tokens, oldest first.
+	The shortest posting list is decoded first and the others are intersected into it, so a rare term keeps the work small.
+*/
+vector<unsigned int> InvertedIndex::find(const vector<string>& tokens) const {
+	vector<const PostingList*> lists;
+	for(const string& token : tokens) {
+		auto it = postings.find(token);
+		if(it == postings.end())
+			return vector<unsigned int>();
+		lists.push_back(&it->second);
+	}
+	if(lists.empty())
+		return vector<unsigned int>();
+	sort(lists.begin(), lists.end(), [](const PostingList* a, const PostingList* b) { return a->count < b->count; });
+	vector<unsigned int> matches = decode(*lists[0]);
+	for(size_t i = 1; i < lists.size() && !matches.empty(); i++) {
+		vector<unsigned int> next = decode(*lists[i]);
+		vector<unsigned int> intersection;
+		set_intersection(matches.begin(), matches.end(), next.begin(), next.end(), back_inserter(intersection));
+		matches.swap(intersection);
+	}
+	return matches;
+}
+
+/* Splits text into lowercase runs of letters and digits, each distinct token once. Tokens longer than ARCHIVE_MAX_TOKEN_LENGTH are cut short. */
+vector<string> InvertedIndex::tokenize(const string& text) {
+	vector<string> tokens;
+	string token;
+	for(size_t i = 0; i <= text.length(); i++) {
+		if(i < text.length() && isalnum((unsigned char)text[i])) {
+			if(token.length() < ARCHIVE_MAX_TOKEN_LENGTH)
+				token += (char)tolower((unsigned char)text[i]);
+		} else if(!token.empty()) {
+			if(std::find(tokens.begin(), tokens.end(), token) == tokens.end())
+				tokens.push_back(token);
+			token.clear();
+		}
+	}
+	return tokens;
+}
+
+/* Unpacks a posting list back into message numbers. */
+vector<unsigned int> InvertedIndex::decode(const PostingList& list) {
+	vector<unsigned int> numbers;
+	numbers.reserve(list.count);
+	unsigned int value = 0;
+	unsigned int delta = 0;
+	unsigned int shift = 0;
+	for(char c : list.deltas) {
+		delta |= (unsigned int)(c & 0x7F) << shift;
+		if(c & 0x80) {
+			shift += 7;
+			continue;
+		}
+		value += delta;
+		numbers.push_back(value);
+		delta = 0;
+		shift = 0;
+	}
+	return numbers;
+}
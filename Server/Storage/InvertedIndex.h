@@ -0,0 +1,27 @@
+#ifndef INVERTED_INDEX_H_
+#define INVERTED_INDEX_H_
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/* Every message a token appears in, as the gaps between message numbers packed into varints. */
+struct PostingList {
+	std::string deltas;
+	unsigned int last;
+	unsigned int count;
+};
+
+/* Maps each token to the messages it appears in, so a search only decodes the postings of its own terms.
+	Messages are numbered in the order they're added, which keeps the gaps between postings small.
+	Not thread safe, the owner locks around it.
+*/
+class InvertedIndex {
+public:
+	void add(unsigned int messageNumber, const std::string& text);
+	std::vector<unsigned int> find(const std::vector<std::string>& tokens) const;
+	static std::vector<std::string> tokenize(const std::string& text);
+private:
+	static std::vector<unsigned int> decode(const PostingList& postings);
+	std::unordered_map<std::string, PostingList> postings;
+};
+#endif //INVERTED_INDEX_H_
@@ -0,0 +1,298 @@
+#include "OfflineSpool.h"
+#include "BinaryCodec.h"
+#include <windows.h>
+#include <io.h>
+#include <share.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <chrono>
+using namespace std;
+
+#define SPOOL_RECORD_HEADER_LENGTH 8
+
+/* Encodes a message as [payload length][checksum][payload]. */
+static string encodeMessage(const OfflineMessage& message) {
+	string payload;
+	BinaryWriter writer(payload);
+	writer.putString(message.from);
+	writer.putShort(message.nameColor);
+	writer.putShort(message.chatColor);
+	writer.putString(message.message);
+	string frame;
+	BinaryWriter header(frame);
+	header.putInt((unsigned int)payload.size());
+	header.putInt(checksum(payload.data(), payload.size()));
+	return frame + payload;
+}
+
+/* Decodes every message in a segment file, stopping at the first torn or corrupted record. */
+static void decodeSegment(const string& data, vector<OfflineMessage>& out) {
+	size_t offset = 0;
+	try {
+		while(data.size() - offset >= SPOOL_RECORD_HEADER_LENGTH) {
+			BinaryReader header(data.data() + offset, SPOOL_RECORD_HEADER_LENGTH);
+			unsigned int payloadLength = header.getInt();
+			unsigned int expected = header.getInt();
+			if(data.size() - offset - SPOOL_RECORD_HEADER_LENGTH < payloadLength)
+				return;
+			const char* payload = data.data() + offset + SPOOL_RECORD_HEADER_LENGTH;
+			if(checksum(payload, payloadLength) != expected)
+				return;
+			BinaryReader reader(payload, payloadLength);
+			OfflineMessage message;
+			message.from = reader.getString();
+			message.nameColor = reader.getShort();
+			message.chatColor = reader.getShort();
+			message.message = reader.getString();
+			out.push_back(message);
+			offset += SPOOL_RECORD_HEADER_LENGTH + payloadLength;
+		}
+	} catch(exception&) {
+	}
+}
+
+/* Reads a whole segment file, returns an empty string if it doesn't exist. */
+static string readSegment(const string& path) {
+	ifstream segmentFile(path, ios::binary);
+	if(!segmentFile.is_open())
+		return "";
+	return string(istreambuf_iterator<char>(segmentFile), istreambuf_iterator<char>());
+}
+
+OfflineSpool::OfflineSpool(const string& directory) :
+	directory(directory),
+	running(true) {
+	scan();
+	spoolThreadInstance = thread(&OfflineSpool::spoolLoop, this);
+}
+
+OfflineSpool::~OfflineSpool() {
+	mtx.lock();
+	running = false;
+	mtx.unlock();
+	wake.notify_one();
+	if(spoolThreadInstance.joinable())
+		spoolThreadInstance.join();
+}
+
+/* Queues a message for an offline user, it reaches the disk on the next pass of the spool thread.
+	Returns false without queueing it if the user already has SPOOL_MAX_MESSAGES_PER_USER messages waiting.
+*/
+bool OfflineSpool::enqueue(const string& lowercaseRecipient, const OfflineMessage& message) {
+	string record = encodeMessage(message);
+	lock_guard<mutex> lock(mtx);
+	unsigned int& pendingCount = pendingCounts[lowercaseRecipient];
+	if(pendingCount >= SPOOL_MAX_MESSAGES_PER_USER)
+		return false;
+	queued[lowercaseRecipient].push_back(record);
+	pendingCount++;
+	return true;
+}
+
+/* Returns how many messages are waiting for the user, including any not yet acknowledged from an earlier delivery. */
+unsigned int OfflineSpool::getPendingCount(const string& lowercaseRecipient) {
+	lock_guard<mutex> lock(mtx);
+	auto it = pendingCounts.find(lowercaseRecipient);
+	return it == pendingCounts.end() ? 0 : it->second;
+}
+
+/* Starts delivering every message waiting for the user, setting the cursor to the segments holding them. Returns false if there is nothing to deliver.
+	The current segment is sealed first, so messages spooled during delivery go to a new segment and aren't lost when the delivered ones are acknowledged.
+	A delivery started before, but never acknowledged, is started over.
+*/
+bool OfflineSpool::beginDelivery(const string& lowercaseRecipient, OfflineCursor& cursor) {
+	lock_guard<mutex> diskLock(diskMutex);
+	vector<string> records;
+	mtx.lock();
+	auto queuedIt = queued.find(lowercaseRecipient);
+	if(queuedIt != queued.end()) {
+		records.swap(queuedIt->second);
+		queued.erase(queuedIt);
+	}
+	mtx.unlock();
+	if(!records.empty())
+		appendRecords(lowercaseRecipient, records);
+	auto it = entries.find(lowercaseRecipient);
+	if(it == entries.end())
+		return false;
+	SpoolEntry& entry = it->second;
+	if(entry.writeSegmentBytes > 0) {
+		entry.writeSegment++;
+		entry.writeSegmentBytes = 0;
+	}
+	entry.deliveredThrough = entry.writeSegment;
+	entry.deliveredCount = 0;
+	cursor = {entry.firstSegment, entry.writeSegment, 0};
+	return cursor.segment < cursor.endSegment;
+}
+
+/* Reads the messages in the next segment of a delivery that holds any, moving the cursor past it. Returns true once the cursor has reached the end.
+	The segments being delivered are sealed and only deleted by acknowledge(), so they are read without holding the disk lock.
+	If the whole delivery turned out to hold no readable messages its segments are deleted, there is nothing for the client to acknowledge.
+*/
+bool OfflineSpool::readNext(const string& lowercaseRecipient, OfflineCursor& cursor, vector<OfflineMessage>& messages) {
+	while(messages.empty() && cursor.segment < cursor.endSegment) {
+		decodeSegment(readSegment(segmentPath(lowercaseRecipient, cursor.segment)), messages);
+		cursor.segment++;
+	}
+	cursor.delivered += (unsigned int)messages.size();
+	lock_guard<mutex> diskLock(diskMutex);
+	auto it = entries.find(lowercaseRecipient);
+	if(it == entries.end() || it->second.deliveredThrough != cursor.endSegment) //Acknowledged or started over by another delivery.
+		return true;
+	SpoolEntry& entry = it->second;
+	entry.deliveredCount += (unsigned int)messages.size();
+	if(cursor.segment < cursor.endSegment)
+		return false;
+	if(cursor.delivered == 0) { //Nothing readable was left in the segments.
+		for(unsigned int segment = entry.firstSegment; segment < cursor.endSegment; segment++) {
+			DeleteFileA(segmentPath(lowercaseRecipient, segment).c_str());
+		}
+		entry.firstSegment = cursor.endSegment;
+		if(entry.firstSegment == entry.writeSegment && entry.writeSegmentBytes == 0) {
+			entries.erase(it);
+			lock_guard<mutex> lock(mtx);
+			if(queued.find(lowercaseRecipient) == queued.end())
+				pendingCounts.erase(lowercaseRecipient);
+		}
+	}
+	return true;
+}
+
+/* Removes the segments sent by the last delivery once the client confirms it received all count messages.
+	Returns false if the count doesn't match, in which case the messages are kept and delivered again next login.
+*/
+bool OfflineSpool::acknowledge(const string& lowercaseRecipient, unsigned int count) {
+	lock_guard<mutex> diskLock(diskMutex);
+	auto it = entries.find(lowercaseRecipient);
+	if(it == entries.end() || it->second.deliveredCount == 0 || it->second.deliveredCount != count)
+		return false;
+	SpoolEntry& entry = it->second;
+	for(unsigned int segment = entry.firstSegment; segment < entry.deliveredThrough; segment++) {
+		DeleteFileA(segmentPath(lowercaseRecipient, segment).c_str());
+	}
+	entry.firstSegment = entry.deliveredThrough;
+	entry.deliveredCount = 0;
+	if(entry.firstSegment == entry.writeSegment && entry.writeSegmentBytes == 0)
+		entries.erase(it);
+	lock_guard<mutex> lock(mtx);
+	auto countIt = pendingCounts.find(lowercaseRecipient);
+	if(countIt != pendingCounts.end()) {
+		countIt->second = countIt->second > count ? countIt->second - count : 0;
+		if(countIt->second == 0)
+			pendingCounts.erase(countIt);
+	}
+	return true;
+}
+
+/* Writes the queued messages every SPOOL_FLUSH_MS until stopped, then writes whatever is left. */
+void OfflineSpool::spoolLoop() {
+	unique_lock<mutex> lock(mtx);
+	while(running || !queued.empty()) {
+		wake.wait_for(lock, chrono::milliseconds(SPOOL_FLUSH_MS), [this]() { return !running; });
+		if(queued.empty())
+			continue;
+		lock.unlock();
+		lock_guard<mutex> diskLock(diskMutex); //Taken before the queue is swapped out so a delivery never misses messages in flight.
+		lock.lock();
+		unordered_map<string, vector<string>> batch;
+		batch.swap(queued);
+		lock.unlock();
+		for(const auto& recipient : batch) {
+			appendRecords(recipient.first, recipient.second);
+		}
+		lock.lock();
+	}
+}
+
+/* Finds the segments left over from the last run and counts the messages in them.
+	Writing starts in a fresh segment after the newest one, so a torn tail is never appended to.
+*/
+void OfflineSpool::scan() {
+	WIN32_FIND_DATAA findData;
+	HANDLE search = FindFirstFileA((directory + "*.spool").c_str(), &findData);
+	if(search == INVALID_HANDLE_VALUE)
+		return;
+	do {
+		if(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		string fileName = findData.cFileName;
+		string baseName = fileName.substr(0, fileName.length() - 6);
+		size_t dotPos = baseName.rfind('.');
+		if(dotPos == string::npos)
+			continue;
+		string recipient = baseName.substr(0, dotPos);
+		unsigned int segment = 0;
+		try {
+			segment = stoul(baseName.substr(dotPos + 1));
+		} catch(exception&) {
+			continue;
+		}
+		vector<OfflineMessage> messages;
+		decodeSegment(readSegment(directory + fileName), messages);
+		auto it = entries.find(recipient);
+		if(it == entries.end()) {
+			entries[recipient] = {segment, segment + 1, 0, segment, 0};
+		} else {
+			if(segment < it->second.firstSegment)
+				it->second.firstSegment = it->second.deliveredThrough = segment;
+			if(segment + 1 > it->second.writeSegment)
+				it->second.writeSegment = segment + 1;
+		}
+		if(!messages.empty())
+			pendingCounts[recipient] += (unsigned int)messages.size();
+	} while(FindNextFileA(search, &findData));
+	FindClose(search);
+}
+
+/* Appends encoded records to the recipient's current segment, moving on to a new segment once it would pass SPOOL_SEGMENT_BYTES.
+	The files are synced before returning. Records that can't be written are dropped and no longer counted as pending.
+	Must be called with diskMutex held and the queue mutex not held.
+*/
+void OfflineSpool::appendRecords(const string& lowercaseRecipient, const vector<string>& records) {
+	SpoolEntry& entry = entries[lowercaseRecipient];
+	FILE* segmentFile = nullptr;
+	unsigned int written = 0;
+	for(const string& record : records) {
+		if(entry.writeSegmentBytes > 0 && entry.writeSegmentBytes + record.size() > SPOOL_SEGMENT_BYTES) {
+			if(segmentFile != nullptr) {
+				fflush(segmentFile);
+				_commit(_fileno(segmentFile));
+				fclose(segmentFile);
+				segmentFile = nullptr;
+			}
+			entry.writeSegment++;
+			entry.writeSegmentBytes = 0;
+		}
+		if(segmentFile == nullptr) {
+			segmentFile = _fsopen(segmentPath(lowercaseRecipient, entry.writeSegment).c_str(), "ab", _SH_DENYNO);
+			if(segmentFile == nullptr) {
+				unsigned int dropped = (unsigned int)records.size() - written;
+				cout << "Failure opening the spool for " << lowercaseRecipient << ", " << dropped << " messages were dropped." << endl;
+				lock_guard<mutex> lock(mtx);
+				auto countIt = pendingCounts.find(lowercaseRecipient);
+				if(countIt != pendingCounts.end()) {
+					countIt->second = countIt->second > dropped ? countIt->second - dropped : 0;
+					if(countIt->second == 0)
+						pendingCounts.erase(countIt);
+				}
+				return;
+			}
+		}
+		fwrite(record.data(), 1, record.size(), segmentFile);
+		entry.writeSegmentBytes += (unsigned int)record.size();
+		written++;
+	}
+	if(segmentFile != nullptr) {
+		fflush(segmentFile);
+		_commit(_fileno(segmentFile));
+		fclose(segmentFile);
+	}
+}
+
+/* Returns the path of one of the recipient's segment files. */
+string OfflineSpool::segmentPath(const string& lowercaseRecipient, unsigned int segment) {
+	return directory + lowercaseRecipient + "." + to_string(segment) + ".spool";
+}
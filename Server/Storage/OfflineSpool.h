@@ -0,0 +1,69 @@
+#ifndef OFFLINE_SPOOL_H_
+#define OFFLINE_SPOOL_H_
+#include "../Constants.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* A private message waiting for its recipient to log in. */
+struct OfflineMessage {
+	std::string from;
+	unsigned short nameColor;
+	unsigned short chatColor;
+	std::string message;
+};
+
+/* Where a recipient's spooled messages sit on disk.
+	Segments firstSegment up to (not including) writeSegment hold messages, new messages are appended to writeSegment.
+	Segments before deliveredThrough have been sent and are waiting for the client to acknowledge them.
+*/
+struct SpoolEntry {
+	unsigned int firstSegment;
+	unsigned int writeSegment;
+	unsigned int writeSegmentBytes;
+	unsigned int deliveredThrough;
+	unsigned int deliveredCount;
+};
+
+/* How far a delivery in progress has read through a recipient's segments, segment up to (not including) endSegment are still to be sent. */
+struct OfflineCursor {
+	unsigned int segment;
+	unsigned int endSegment;
+	unsigned int delivered;
+};
+
+/* Holds private messages sent to offline users until they next log in.
+	Sending only queues the message in memory, a background thread appends the queue to the recipient's segment files every SPOOL_FLUSH_MS and syncs them.
+	Each recipient's messages are split over numbered segment files of up to SPOOL_SEGMENT_BYTES, so delivery streams one segment at a time and an acknowledged segment is simply deleted.
+	A delivery is started with beginDelivery() and the recipient's writer reads one segment at a time with readNext() as its private lane drains, so a large spool never sits in memory or holds the disk lock all at once.
+	Segments are only deleted once the client acknowledges the last batch, a recipient who disconnects part way through gets the messages again next login.
+	Each recipient can have at most SPOOL_MAX_MESSAGES_PER_USER messages waiting, counting those delivered but not yet acknowledged.
+*/
+class OfflineSpool {
+public:
+	OfflineSpool(const std::string& directory);
+	~OfflineSpool();
+	bool enqueue(const std::string& lowercaseRecipient, const OfflineMessage& message);
+	unsigned int getPendingCount(const std::string& lowercaseRecipient);
+	bool beginDelivery(const std::string& lowercaseRecipient, OfflineCursor& cursor);
+	bool readNext(const std::string& lowercaseRecipient, OfflineCursor& cursor, std::vector<OfflineMessage>& messages);
+	bool acknowledge(const std::string& lowercaseRecipient, unsigned int count);
+	void spoolLoop();
+private:
+	void scan();
+	void appendRecords(const std::string& lowercaseRecipient, const std::vector<std::string>& records);
+	std::string segmentPath(const std::string& lowercaseRecipient, unsigned int segment);
+	const std::string directory;
+	std::unordered_map<std::string, SpoolEntry> entries;
+	std::mutex diskMutex;
+	std::unordered_map<std::string, std::vector<std::string>> queued;
+	std::unordered_map<std::string, unsigned int> pendingCounts;
+	std::mutex mtx;
+	std::condition_variable wake;
+	bool running;
+	std::thread spoolThreadInstance;
+};
+#endif //OFFLINE_SPOOL_H_
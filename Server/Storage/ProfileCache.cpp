@@ -0,0 +1,65 @@
+#include "ProfileCache.h"
+using namespace std;
+
+ProfileCache::ProfileCache() :
+	hits(0),
+	misses(0),
+	reportedHits(0),
+	reportedMisses(0) {}
+
+/* Gives back the cached record and marks it as the most recently used. Returns false on a miss. */
+bool ProfileCache::get(const string& lowercaseName, UserRecord& record) {
+	lock_guard<mutex> lock(mtx);
+	auto it = lookup.find(lowercaseName);
+	if(it == lookup.end()) {
+		misses++;
+		return false;
+	}
+	hits++;
+	entries.splice(entries.begin(), entries, it->second);
+	record = it->second->second;
+	return true;
+}
+
+/* Caches the record as the most recently used, evicting the least recently used one once full. */
+void ProfileCache::put(const string& lowercaseName, const UserRecord& record) {
+	lock_guard<mutex> lock(mtx);
+	auto it = lookup.find(lowercaseName);
+	if(it != lookup.end()) {
+		it->second->second = record;
+		entries.splice(entries.begin(), entries, it->second);
+		return;
+	}
+	insert(lowercaseName, record);
+}
+
+/* Caches a record read from outside the cache, unless the user is already cached.
+	A save made while the record was being read has already been put in the cache and is newer, so it must not be replaced.
+*/
+void ProfileCache::putIfAbsent(const string& lowercaseName, const UserRecord& record) {
+	lock_guard<mutex> lock(mtx);
+	if(lookup.find(lowercaseName) == lookup.end())
+		insert(lowercaseName, record);
+}
+
+/* Adds a record that isn't cached yet as the most recently used, evicting the least recently used one once full. Must be called with the mutex locked. */
+void ProfileCache::insert(const string& lowercaseName, const UserRecord& record) {
+	entries.push_front(make_pair(lowercaseName, record));
+	lookup[lowercaseName] = entries.begin();
+	if(entries.size() > PROFILE_CACHE_SIZE) {
+		lookup.erase(entries.back().first);
+		entries.pop_back();
+	}
+}
+
+/* Describes the hit rate since the last call, or returns an empty string if there were no lookups. */
+string ProfileCache::takeStats() {
+	lock_guard<mutex> lock(mtx);
+	unsigned long long newHits = hits - reportedHits;
+	unsigned long long newMisses = misses - reportedMisses;
+	reportedHits = hits;
+	reportedMisses = misses;
+	if(newHits + newMisses == 0)
+		return "";
+	return "Profile cache: " + to_string(newHits) + " hits, " + to_string(newMisses) + " misses (" + to_string(newHits * 100 / (newHits + newMisses)) + "% hit rate), " + to_string(entries.size()) + " cached.";
+}
@@ -0,0 +1,32 @@
+#ifndef PROFILE_CACHE_H_
+#define PROFILE_CACHE_H_
+#include "../Constants.h"
+#include "UserRecord.h"
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <mutex>
+
+/* Keeps the PROFILE_CACHE_SIZE most recently used user records decoded in memory so logging back in doesn't go to the store.
+	Saves write through the cache, so a cached record is always the user's latest state.
+*/
+class ProfileCache {
+public:
+	ProfileCache();
+	bool get(const std::string& lowercaseName, UserRecord& record);
+	void put(const std::string& lowercaseName, const UserRecord& record);
+	void putIfAbsent(const std::string& lowercaseName, const UserRecord& record);
+	std::string takeStats();
+private:
+	void insert(const std::string& lowercaseName, const UserRecord& record);
+	typedef std::pair<std::string, UserRecord> Entry;
+	std::list<Entry> entries;
+	std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long reportedHits;
+	unsigned long long reportedMisses;
+	std::mutex mtx;
+};
+#endif //PROFILE_CACHE_H_
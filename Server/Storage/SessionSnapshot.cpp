@@ -0,0 +1,156 @@
+#include "SessionSnapshot.h"
+#include "BinaryCodec.h"
+#include <windows.h>
+#include <io.h>
+#include <share.h>
+#include <cstdio>
+#include <unordered_map>
+#include <iostream>
+using namespace std;
+
+#define SNAPSHOT_MAGIC 0x44525353
+#define SNAPSHOT_HEADER_LENGTH 12
+
+SessionSnapshotter::SessionSnapshotter(const string& directory) :
+	path(directory + SNAPSHOT_FILE),
+	running(true) {
+	snapshotThreadInstance = thread(&SessionSnapshotter::snapshotLoop, this);
+}
+
+SessionSnapshotter::~SessionSnapshotter() {
+	mtx.lock();
+	running = false;
+	mtx.unlock();
+	wake.notify_one();
+	if(snapshotThreadInstance.joinable())
+		snapshotThreadInstance.join();
+}
+
+/* Hands a snapshot over to be written. If the last one hasn't been written yet it is replaced, only the latest state matters. */
+void SessionSnapshotter::submit(shared_ptr<const ServerSnapshot> snapshot) {
+	mtx.lock();
+	pending = snapshot;
+	mtx.unlock();
+	wake.notify_one();
+}
+
+/* Writes each submitted snapshot, and whatever is still waiting when stopped. */
+void SessionSnapshotter::snapshotLoop() {
+	unique_lock<mutex> lock(mtx);
+	while(running || pending != nullptr) {
+		wake.wait(lock, [this]() { return !running || pending != nullptr; });
+		if(pending == nullptr)
+			continue;
+		shared_ptr<const ServerSnapshot> snapshot;
+		snapshot.swap(pending);
+		lock.unlock();
+		if(!write(*snapshot))
+			cout << "Failure writing the session snapshot " << path << "." << endl;
+		lock.lock();
+	}
+}
+
+/* Writes the snapshot to a temporary file and moves it over the last one. */
+bool SessionSnapshotter::write(const ServerSnapshot& snapshot) {
+	string data = encode(snapshot);
+	string tempPath = path + ".tmp";
+	FILE* snapshotFile = _fsopen(tempPath.c_str(), "wb", _SH_DENYNO);
+	if(snapshotFile == nullptr)
+		return false;
+	bool written = fwrite(data.data(), 1, data.size(), snapshotFile) == data.size() && fflush(snapshotFile) == 0;
+	_commit(_fileno(snapshotFile));
+	fclose(snapshotFile);
+	return written && MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+/* Reads the last snapshot written, mapping the file rather than copying it in. Returns false if there is no snapshot or it is damaged. */
+bool SessionSnapshotter::load(ServerSnapshot& snapshot) {
+	HANDLE snapshotFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(snapshotFile == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(snapshotFile, &size) || size.QuadPart < SNAPSHOT_HEADER_LENGTH) {
+		CloseHandle(snapshotFile);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(snapshotFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	const char* view = mapping == nullptr ? nullptr : (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	bool loaded = view != nullptr && decode(view, (size_t)size.QuadPart, snapshot);
+	if(view != nullptr)
+		UnmapViewOfFile(view);
+	if(mapping != nullptr)
+		CloseHandle(mapping);
+	CloseHandle(snapshotFile);
+	return loaded;
+}
+
+/* Encodes the snapshot as [magic][payload length][checksum][payload].
+	The payload is the time it was taken, the room names, then each session as its token, lowercase name, room index plus one (0 for none) and expiry.
+*/
+string SessionSnapshotter::encode(const ServerSnapshot& snapshot) {
+	vector<string> rooms;
+	unordered_map<string, unsigned int> roomIndexes;
+	for(const SnapshotSession& session : snapshot.sessions) {
+		if(!session.room.empty() && roomIndexes.find(session.room) == roomIndexes.end()) {
+			roomIndexes[session.room] = (unsigned int)rooms.size();
+			rooms.push_back(session.room);
+		}
+	}
+	string payload;
+	BinaryWriter writer(payload);
+	writer.putLong((unsigned long long)snapshot.time);
+	writer.putVarint(rooms.size());
+	for(const string& room : rooms) {
+		writer.putString(room);
+	}
+	writer.putVarint(snapshot.sessions.size());
+	for(const SnapshotSession& session : snapshot.sessions) {
+		writer.putString(session.token);
+		writer.putString(session.lowercaseName);
+		writer.putVarint(session.room.empty() ? 0 : roomIndexes[session.room] + 1);
+		writer.putLong((unsigned long long)session.expires);
+	}
+	string data;
+	BinaryWriter header(data);
+	header.putInt(SNAPSHOT_MAGIC);
+	header.putInt((unsigned int)payload.size());
+	header.putInt(checksum(payload.data(), payload.size()));
+	return data + payload;
+}
+
+/* Decodes a snapshot written by encode(), returning false if it is cut short or fails its checksum. */
+bool SessionSnapshotter::decode(const char* data, size_t size, ServerSnapshot& snapshot) {
+	try {
+		BinaryReader header(data, SNAPSHOT_HEADER_LENGTH);
+		if(header.getInt() != SNAPSHOT_MAGIC)
+			return false;
+		unsigned int payloadLength = header.getInt();
+		if(size - SNAPSHOT_HEADER_LENGTH < payloadLength || header.getInt() != checksum(data + SNAPSHOT_HEADER_LENGTH, payloadLength))
+			return false;
+		BinaryReader reader(data + SNAPSHOT_HEADER_LENGTH, payloadLength);
+		snapshot.time = (long long)reader.getLong();
+		unsigned long long roomCount = reader.getVarint();
+		if(roomCount > payloadLength) //A corrupted count, each room takes at least a byte.
+			return false;
+		vector<string> rooms((size_t)roomCount);
+		for(string& room : rooms) {
+			room = reader.getString();
+		}
+		unsigned long long sessionCount = reader.getVarint();
+		if(sessionCount > payloadLength)
+			return false;
+		snapshot.sessions.resize((size_t)sessionCount);
+		for(SnapshotSession& session : snapshot.sessions) {
+			session.token = reader.getString();
+			session.lowercaseName = reader.getString();
+			unsigned long long room = reader.getVarint();
+			if(room > rooms.size())
+				return false;
+			session.room = room == 0 ? "" : rooms[(size_t)room - 1];
+			session.expires = (long long)reader.getLong();
+		}
+		return true;
+	} catch(exception&) {
+		return false;
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef SESSION_SNAPSHOT_H_
+#define SESSION_SNAPSHOT_H_
+#include "../Constants.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* A session that can be resumed with its token. room is empty if the user wasn't in a room.
+	expires is when a disconnected session stops being resumable, 0 for sessions that were still connected when the snapshot was taken.
+*/
+struct SnapshotSession {
+	std::string token;
+	std::string lowercaseName;
+	std::string room;
+	long long expires;
+};
+
+/* Every resumable session and the room it was in at one point in time. Never changed once captured, so it can be written out while the server carries on. */
+struct ServerSnapshot {
+	long long time;
+	std::vector<SnapshotSession> sessions;
+};
+
+/* Writes snapshots of the server's sessions and room memberships so a restarted server can let its users resume where they left off.
+	The server captures a new snapshot whenever its sessions change and hands it over with submit(), a background thread writes the latest one it was given.
+	Snapshots are written to a temporary file and moved over the old one, so a crash leaves either the old or the new snapshot whole.
+	The file holds [magic][payload length][checksum][payload], with each room name written once and sessions referring to their room by index.
+*/
+class SessionSnapshotter {
+public:
+	SessionSnapshotter(const std::string& directory);
+	~SessionSnapshotter();
+	void submit(std::shared_ptr<const ServerSnapshot> snapshot);
+	bool load(ServerSnapshot& snapshot);
+	void snapshotLoop();
+private:
+	bool write(const ServerSnapshot& snapshot);
+	static std::string encode(const ServerSnapshot& snapshot);
+	static bool decode(const char* data, size_t size, ServerSnapshot& snapshot);
+	const std::string path;
+	std::shared_ptr<const ServerSnapshot> pending;
+	std::mutex mtx;
+	std::condition_variable wake;
+	bool running;
+	std::thread snapshotThreadInstance;
+};
+#endif //SESSION_SNAPSHOT_H_
@@ -0,0 +1,81 @@
+#include "UserPersister.h"
+#include <chrono>
+#include <iostream>
+using namespace std;
+
+UserPersister::UserPersister(UserStore& store) :
+	store(store),
+	running(true) {
+	persistThreadInstance = thread(&UserPersister::persistLoop, this);
+}
+
+UserPersister::~UserPersister() {
+	mtx.lock();
+	running = false;
+	mtx.unlock();
+	wake.notify_one();
+	if(persistThreadInstance.joinable())
+		persistThreadInstance.join();
+}
+
+/* Records the user's current state to be written on the next pass. */
+void UserPersister::markDirty(const string& lowercaseName, const UserRecord& record) {
+	lock_guard<mutex> lock(mtx);
+	dirty[lowercaseName] = record;
+}
+
+/* Finds a save that hasn't reached the disk yet, so loading a user who just logged out doesn't read an outdated file.
+	Returns false if nothing is pending for the user.
+*/
+bool UserPersister::findPending(const string& lowercaseName, UserRecord& record) {
+	lock_guard<mutex> lock(mtx);
+	auto it = dirty.find(lowercaseName);
+	if(it == dirty.end()) {
+		it = writing.find(lowercaseName);
+		if(it == writing.end())
+			return false;
+	}
+	record = it->second;
+	return true;
+}
+
+/* Writes the dirty users every PERSIST_INTERVAL_MS until stopped, then writes whatever is left.
+	Failed records go back to being dirty, a save made while they were being written is newer and is kept instead.
+	Once stopped a failed write isn't retried, the records are reported as lost rather than holding up the shutdown.
+*/
+void UserPersister::persistLoop() {
+	unique_lock<mutex> lock(mtx);
+	while(running || !dirty.empty()) {
+		wake.wait_for(lock, chrono::milliseconds(PERSIST_INTERVAL_MS), [this]() { return !running; });
+		if(dirty.empty())
+			continue;
+		writing.swap(dirty);
+		lock.unlock();
+		unordered_map<string, UserRecord> failed;
+		writeBatch(writing, failed);
+		lock.lock();
+		writing.clear();
+		for(auto& entry : failed) {
+			dirty.emplace(entry.first, entry.second);
+		}
+		if(!failed.empty() && !running) {
+			cout << "Could not write " << dirty.size() << " user saves before shutting down." << endl;
+			break;
+		}
+	}
+}
+
+/* Appends every record in the batch to the store and syncs them with a single flush to disk, putting whatever didn't make it to disk into failed.
+	Compaction of the store also happens here, off the packet handling threads.
+*/
+void UserPersister::writeBatch(const unordered_map<string, UserRecord>& batch, unordered_map<string, UserRecord>& failed) {
+	for(const auto& entry : batch) {
+		if(!store.put(entry.first, entry.second))
+			failed.insert(entry);
+	}
+	if(!store.sync()) {
+		failed = batch;
+		return;
+	}
+	store.compactIfNeeded();
+}
@@ -0,0 +1,35 @@
+#ifndef USER_PERSISTER_H_
+#define USER_PERSISTER_H_
+#include "../Constants.h"
+#include "UserRecord.h"
+#include "UserStore.h"
+#include <string>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* Writes user saves to the UserStore on a background thread.
+	Saving only records the latest state of the user as dirty, any further saves before the next write replace it so a burst of changes becomes one write.
+	Every PERSIST_INTERVAL_MS the dirty users are appended to the store together and synced to disk as a group.
+	Records that fail to write are marked dirty again for the next pass, unless a newer save of the same user is already waiting.
+	Whatever is still dirty when the persister is destroyed is written before it returns.
+*/
+class UserPersister {
+public:
+	UserPersister(UserStore& store);
+	~UserPersister();
+	void markDirty(const std::string& lowercaseName, const UserRecord& record);
+	bool findPending(const std::string& lowercaseName, UserRecord& record);
+	void persistLoop();
+private:
+	void writeBatch(const std::unordered_map<std::string, UserRecord>& batch, std::unordered_map<std::string, UserRecord>& failed);
+	UserStore& store;
+	std::unordered_map<std::string, UserRecord> dirty;
+	std::unordered_map<std::string, UserRecord> writing;
+	std::mutex mtx;
+	std::condition_variable wake;
+	bool running;
+	std::thread persistThreadInstance;
+};
+#endif //USER_PERSISTER_H_
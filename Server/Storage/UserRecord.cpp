@@ -0,0 +1,43 @@
+#include "UserRecord.h"
+#include <exception>
+using namespace std;
+
+UserRecord::UserRecord() :
+	nameColor(DEFAULT_COLOR),
+	chatColor(DEFAULT_CHAT_COLOR) {}
+
+/* Reads a user save file, throwing if the file version isn't supported or the file is cut short.
+	This is the only parser for the text format, both the server's import and the UserImporter tool go through it.
+*/
+void UserRecord::read(istream& in) {
+	unsigned short version = 0;
+	in >> version;
+	switch(version) {
+		case 2:
+			in >> name;
+			in >> nameColor;
+			in >> chatColor;
+			in >> password;
+			if(in.fail())
+				throw exception("File ended before the password");
+			for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
+				friends[i] = "";
+				in >> friends[i];
+			}
+			break;
+		default:
+			throw exception("Unsupported file version");
+	}
+}
+
+/* Writes the record in the current save file version. */
+void UserRecord::write(ostream& out) const {
+	out << (unsigned short)USER_FILE_VERSION << endl;
+	out << name << endl;
+	out << nameColor << endl;
+	out << chatColor << endl;
+	out << password << endl;
+	for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
+		out << friends[i] << endl;
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef USER_RECORD_H_
+#define USER_RECORD_H_
+#include "../Constants.h"
+#include <string>
+#include <istream>
+#include <ostream>
+
+/* Everything that is saved for a user, in the layout of the user's save file. */
+struct UserRecord {
+	UserRecord();
+	void read(std::istream& in);
+	void write(std::ostream& out) const;
+	std::string name;
+	unsigned short nameColor;
+	unsigned short chatColor;
+	std::string password;
+	std::string friends[MAX_FRIENDS];
+};
+#endif //USER_RECORD_H_
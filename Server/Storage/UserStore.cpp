@@ -0,0 +1,397 @@
+#include "UserStore.h"
+#include "BinaryCodec.h"
+#include <windows.h>
+#include <io.h>
+#include <share.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+using namespace std;
+
+#define RECORD_HEADER_LENGTH 8
+#define RECORD_PUT 1
+#define INDEX_MAGIC 0x32524958
+
+/* Encodes a record as [payload length][checksum][payload]. */
+static string encodeRecord(const string& lowercaseName, const UserRecord& record) {
+	string payload;
+	BinaryWriter writer(payload);
+	writer.putByte(RECORD_PUT);
+	writer.putString(lowercaseName);
+	writer.putString(record.name);
+	writer.putShort(record.nameColor);
+	writer.putShort(record.chatColor);
+	writer.putString(record.password);
+	unsigned char friendCount = 0;
+	for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
+		if(!record.friends[i].empty())
+			friendCount++;
+	}
+	writer.putByte(friendCount);
+	for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
+		if(!record.friends[i].empty())
+			writer.putString(record.friends[i]);
+	}
+	string frame;
+	BinaryWriter header(frame);
+	header.putInt((unsigned int)payload.size());
+	header.putInt(checksum(payload.data(), payload.size()));
+	return frame + payload;
+}
+
+/* Decodes a record written by encodeRecord(), returns false if it is torn or corrupted. */
+static bool decodeRecord(const char* frame, unsigned long long available, string& lowercaseName, UserRecord& record, unsigned int& length) {
+	try {
+		if(available < RECORD_HEADER_LENGTH)
+			return false;
+		BinaryReader header(frame, RECORD_HEADER_LENGTH);
+		unsigned int payloadLength = header.getInt();
+		unsigned int expected = header.getInt();
+		if(available - RECORD_HEADER_LENGTH < payloadLength)
+			return false;
+		const char* payload = frame + RECORD_HEADER_LENGTH;
+		if(checksum(payload, payloadLength) != expected)
+			return false;
+		BinaryReader reader(payload, payloadLength);
+		if(reader.getByte() != RECORD_PUT)
+			return false;
+		lowercaseName = reader.getString();
+		record.name = reader.getString();
+		record.nameColor = reader.getShort();
+		record.chatColor = reader.getShort();
+		record.password = reader.getString();
+		unsigned char friendCount = reader.getByte();
+		for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
+			record.friends[i] = (i < friendCount ? reader.getString() : "");
+		}
+		length = RECORD_HEADER_LENGTH + payloadLength;
+		return true;
+	} catch(exception&) {
+		return false;
+	}
+}
+
+UserStore::UserStore(const string& directory) :
+	logPath(directory + USER_STORE_FILE),
+	indexPath(directory + USER_STORE_INDEX_FILE),
+	logFile(nullptr),
+	logSize(0),
+	liveBytes(0),
+	mapFile(INVALID_HANDLE_VALUE),
+	mapping(nullptr),
+	view(nullptr),
+	viewSize(0) {
+	logFile = _fsopen(logPath.c_str(), "ab", _SH_DENYNO);
+	if(logFile == nullptr)
+		throw exception("Could not open the user store.");
+	fseek(logFile, 0, SEEK_END);
+	logSize = ftell(logFile);
+	remap();
+	unsigned long long indexedLength = 0;
+	if(!loadIndex(indexedLength)) {
+		index.clear();
+		liveBytes = 0;
+		indexedLength = 0;
+	}
+	replay(indexedLength);
+}
+
+/* Syncs the log and saves the index so the next startup has nothing to replay. */
+UserStore::~UserStore() {
+	lock_guard<mutex> lock(mtx);
+	unmap();
+	if(logFile == nullptr)
+		return;
+	fflush(logFile);
+	_commit(_fileno(logFile));
+	saveIndex();
+	fclose(logFile);
+}
+
+/* Looks up the latest record for the user, returns false if they have never been saved. */
+bool UserStore::find(const string& lowercaseName, UserRecord& record) {
+	lock_guard<mutex> lock(mtx);
+	auto it = index.find(lowercaseName);
+	if(it == index.end())
+		return false;
+	if(it->second.offset + it->second.length > viewSize)
+		remap();
+	if(view == nullptr || it->second.offset + it->second.length > viewSize)
+		return false;
+	string storedName;
+	unsigned int length = 0;
+	return decodeRecord(view + it->second.offset, it->second.length, storedName, record, length);
+}
+
+/* Returns if the user has ever been saved. */
+bool UserStore::exists(const string& lowercaseName) {
+	lock_guard<mutex> lock(mtx);
+	return index.find(lowercaseName) != index.end();
+}
+
+/* Appends the user's record to the log. It isn't durable until the next sync().
+	Returns false if the record couldn't be written, anything partly written is cut back off so the next record starts where the index expects it.
+*/
+bool UserStore::put(const string& lowercaseName, const UserRecord& record) {
+	string frame = encodeRecord(lowercaseName, record);
+	lock_guard<mutex> lock(mtx);
+	if(logFile == nullptr)
+		return false;
+	if(fwrite(frame.data(), 1, frame.size(), logFile) != frame.size() || fflush(logFile) != 0) {
+		cout << "Could not append " << lowercaseName << " to the user store." << endl;
+		clearerr(logFile);
+		unmap();
+		_chsize_s(_fileno(logFile), (long long)logSize);
+		fseek(logFile, 0, SEEK_END);
+		remap();
+		return false;
+	}
+	auto it = index.find(lowercaseName);
+	if(it != index.end())
+		liveBytes -= it->second.length;
+	index[lowercaseName] = {logSize, (unsigned int)frame.size(), record.name};
+	liveBytes += frame.size();
+	logSize += frame.size();
+	return true;
+}
+
+/* Forces everything appended so far to disk. Returns false if it couldn't be. */
+bool UserStore::sync() {
+	lock_guard<mutex> lock(mtx);
+	if(logFile == nullptr)
+		return false;
+	return fflush(logFile) == 0 && _commit(_fileno(logFile)) == 0;
+}
+
+/* Returns if the store has no users at all. */
+bool UserStore::isEmpty() {
+	lock_guard<mutex> lock(mtx);
+	return index.empty();
+}
+
+/* Returns the name of every user in the store as they typed it, straight from the index. */
+vector<string> UserStore::getNames() {
+	lock_guard<mutex> lock(mtx);
+	vector<string> names;
+	names.reserve(index.size());
+	for(auto& entry : index) {
+		names.push_back(entry.second.name);
+	}
+	return names;
+}
+
+/* Imports every version 2 text save file in the directory that isn't already in the store.
+	Returns how many users were imported.
+*/
+unsigned int UserStore::importTextFiles(const string& directory) {
+	unsigned int imported = 0;
+	WIN32_FIND_DATAA findData;
+	HANDLE search = FindFirstFileA((directory + "*.txt").c_str(), &findData);
+	if(search == INVALID_HANDLE_VALUE)
+		return 0;
+	do {
+		if(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		string fileName = findData.cFileName;
+		string username = fileName.substr(0, fileName.length() - 4);
+		transform(username.begin(), username.end(), username.begin(), ::tolower);
+		if(exists(username))
+			continue;
+		ifstream userFile(directory + fileName);
+		if(!userFile.is_open())
+			continue;
+		try {
+			UserRecord record;
+			record.read(userFile);
+			if(put(username, record))
+				imported++;
+		} catch(exception e) {
+			cout << "Failure importing " << fileName << ": " << e.what() << endl;
+		}
+	} while(FindNextFileA(search, &findData));
+	FindClose(search);
+	lock_guard<mutex> lock(mtx);
+	if(logFile == nullptr)
+		return imported;
+	fflush(logFile);
+	_commit(_fileno(logFile));
+	saveIndex();
+	return imported;
+}
+
+/* Compacts the log once overwritten records make up more than half of it. */
+void UserStore::compactIfNeeded() {
+	lock_guard<mutex> lock(mtx);
+	if(logFile == nullptr)
+		return;
+	unsigned long long garbage = logSize - liveBytes;
+	if(garbage >= STORE_COMPACT_MIN_BYTES && garbage > liveBytes)
+		compact();
+}
+
+/* Reads the saved index, giving back how much of the log it covers. Returns false if there is no usable index. */
+bool UserStore::loadIndex(unsigned long long& indexedLength) {
+	ifstream indexFile(indexPath, ios::binary);
+	if(!indexFile.is_open())
+		return false;
+	stringstream contents;
+	contents << indexFile.rdbuf();
+	const string data = contents.str();
+	try {
+		BinaryReader reader(data.data(), data.size());
+		if(reader.getInt() != INDEX_MAGIC)
+			return false;
+		indexedLength = reader.getLong();
+		if(indexedLength > logSize)
+			return false;
+		unsigned int count = reader.getInt();
+		for(unsigned int i = 0; i < count; i++) {
+			string lowercaseName = reader.getString();
+			StoreLocation location;
+			location.offset = reader.getLong();
+			location.length = reader.getInt();
+			location.name = reader.getString();
+			if(location.offset + location.length > indexedLength)
+				return false;
+			index[lowercaseName] = location;
+			liveBytes += location.length;
+		}
+		size_t checkedLength = reader.getPosition();
+		return reader.getInt() == checksum(data.data(), checkedLength);
+	} catch(exception&) {
+		return false;
+	}
+}
+
+/* Writes the index next to the log, must be called with the mutex locked and the log synced. */
+void UserStore::saveIndex() {
+	string data;
+	BinaryWriter writer(data);
+	writer.putInt(INDEX_MAGIC);
+	writer.putLong(logSize);
+	writer.putInt((unsigned int)index.size());
+	for(auto& entry : index) {
+		writer.putString(entry.first);
+		writer.putLong(entry.second.offset);
+		writer.putInt(entry.second.length);
+		writer.putString(entry.second.name);
+	}
+	writer.putInt(checksum(data.data(), data.size()));
+	string tempPath = indexPath + ".tmp";
+	FILE* indexFile = _fsopen(tempPath.c_str(), "wb", _SH_DENYNO);
+	if(indexFile == nullptr)
+		return;
+	bool written = fwrite(data.data(), 1, data.size(), indexFile) == data.size() && fflush(indexFile) == 0;
+	_commit(_fileno(indexFile));
+	fclose(indexFile);
+	if(written)
+		MoveFileExA(tempPath.c_str(), indexPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+/* Rebuilds the index from the records after the given offset.
+	The first record that is cut short or fails its checksum is treated as the end of the log, and the log is truncated there.
+*/
+void UserStore::replay(unsigned long long from) {
+	unsigned long long offset = from;
+	while(offset < viewSize) {
+		string lowercaseName;
+		UserRecord record;
+		unsigned int length = 0;
+		if(!decodeRecord(view + offset, viewSize - offset, lowercaseName, record, length))
+			break;
+		auto it = index.find(lowercaseName);
+		if(it != index.end())
+			liveBytes -= it->second.length;
+		index[lowercaseName] = {offset, length, record.name};
+		liveBytes += length;
+		offset += length;
+	}
+	if(offset < logSize) {
+		cout << "Discarding " << (logSize - offset) << " bytes from the end of the user store." << endl;
+		unmap();
+		_chsize_s(_fileno(logFile), offset);
+		logSize = offset;
+		remap();
+	}
+}
+
+/* Maps the whole log for reading, replacing any earlier mapping. */
+void UserStore::remap() {
+	unmap();
+	if(logSize == 0)
+		return;
+	mapFile = CreateFileA(logPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(mapFile == INVALID_HANDLE_VALUE)
+		return;
+	mapping = CreateFileMappingA(mapFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(mapping == nullptr) {
+		unmap();
+		return;
+	}
+	view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(view == nullptr) {
+		unmap();
+		return;
+	}
+	viewSize = logSize;
+}
+
+/* Releases the mapping of the log. */
+void UserStore::unmap() {
+	if(view != nullptr)
+		UnmapViewOfFile(view);
+	if(mapping != nullptr)
+		CloseHandle(mapping);
+	if(mapFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mapFile);
+	view = nullptr;
+	mapping = nullptr;
+	mapFile = INVALID_HANDLE_VALUE;
+	viewSize = 0;
+}
+
+/* Rewrites the log with only the latest record of each user, must be called with the mutex locked.
+	The old index is deleted before the new log replaces the old one, so a crash part way through falls back to replaying the whole log.
+*/
+void UserStore::compact() {
+	fflush(logFile);
+	if(viewSize < logSize)
+		remap();
+	if(view == nullptr)
+		return;
+	string tempPath = logPath + ".tmp";
+	FILE* compacted = _fsopen(tempPath.c_str(), "wb", _SH_DENYNO);
+	if(compacted == nullptr)
+		return;
+	unordered_map<string, StoreLocation> compactedIndex;
+	unsigned long long offset = 0;
+	for(auto& entry : index) {
+		if(fwrite(view + entry.second.offset, 1, entry.second.length, compacted) != entry.second.length) {
+			fclose(compacted);
+			return;
+		}
+		compactedIndex[entry.first] = {offset, entry.second.length, entry.second.name};
+		offset += entry.second.length;
+	}
+	fflush(compacted);
+	_commit(_fileno(compacted));
+	fclose(compacted);
+	unmap();
+	fclose(logFile);
+	DeleteFileA(indexPath.c_str());
+	if(MoveFileExA(tempPath.c_str(), logPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		index.swap(compactedIndex);
+		logSize = offset;
+		liveBytes = offset;
+	} else {
+		cout << "Could not replace the user store while compacting, error #" << GetLastError() << endl;
+	}
+	logFile = _fsopen(logPath.c_str(), "ab", _SH_DENYNO);
+	remap();
+	if(logFile == nullptr) {
+		cout << "Could not reopen the user store after compacting, saving is disabled until the server restarts." << endl;
+		return;
+	}
+	saveIndex();
+}
@@ -0,0 +1,54 @@
+#ifndef USER_STORE_H_
+#define USER_STORE_H_
+#include "../Constants.h"
+#include "UserRecord.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <cstdio>
+
+/* Where a user's latest record sits inside the log, along with the username as they typed it so it can be listed without reading the record. */
+struct StoreLocation {
+	unsigned long long offset;
+	unsigned int length;
+	std::string name;
+};
+
+/* Keeps every user's record in one append-only log file with an in-memory index from lowercase username to the latest record.
+	Saving appends a new binary record, reads go through a read-only memory mapping of the log.
+	Once overwritten records take up more of the log than live ones, compaction rewrites the log with only the live records.
+	The index is saved alongside the log on shutdown and after compaction, so startup only has to replay records appended after that. A record torn by a crash fails its checksum and is cut off.
+*/
+class UserStore {
+public:
+	UserStore(const std::string& directory);
+	~UserStore();
+	bool find(const std::string& lowercaseName, UserRecord& record);
+	bool exists(const std::string& lowercaseName);
+	bool put(const std::string& lowercaseName, const UserRecord& record);
+	bool sync();
+	bool isEmpty();
+	std::vector<std::string> getNames();
+	unsigned int importTextFiles(const std::string& directory);
+	void compactIfNeeded();
+private:
+	bool loadIndex(unsigned long long& indexedLength);
+	void saveIndex();
+	void replay(unsigned long long from);
+	void remap();
+	void unmap();
+	void compact();
+	const std::string logPath;
+	const std::string indexPath;
+	std::unordered_map<std::string, StoreLocation> index;
+	FILE* logFile;
+	unsigned long long logSize;
+	unsigned long long liveBytes;
+	void* mapFile;
+	void* mapping;
+	const char* view;
+	unsigned long long viewSize;
+	std::mutex mtx;
+};
+#endif //USER_STORE_H_
@@ -0,0 +1,112 @@
+#include "SymbolTable.h"
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+using namespace std;
+
+SymbolTable::SymbolTable() : count(0) {
+	for(unsigned int i = 0; i < SYMBOL_CHUNK_COUNT; i++) {
+		chunks[i].store(nullptr);
+	}
+	intern(""); //EMPTY_SYMBOL
+}
+
+/* Returns the id of the name, adding it (and its case folded form) to the table if it hasn't been seen before.
+	The caller holds a reference to the symbol until it calls release().
+*/
+SymbolId SymbolTable::intern(const string& name) {
+	lock_guard<mutex> lock(mtx);
+	return internLocked(name);
+}
+
+/* Takes another reference to a symbol the caller already holds one to, for handing it on to something that outlives the caller's. */
+void SymbolTable::retain(SymbolId id) {
+	lock_guard<mutex> lock(mtx);
+	slot(id).references++;
+}
+
+/* Gives back a reference taken by intern() or retain(). The empty name is always kept. */
+void SymbolTable::release(SymbolId id) {
+	if(id == EMPTY_SYMBOL)
+		return;
+	lock_guard<mutex> lock(mtx);
+	releaseLocked(id);
+}
+
+/* Returns the id of the name if it has been interned, otherwise NO_SYMBOL. Never adds to the table. */
+SymbolId SymbolTable::find(const string& name) {
+	lock_guard<mutex> lock(mtx);
+	auto found = ids.find(name);
+	return found == ids.end() ? NO_SYMBOL : found->second;
+}
+
+/* Returns the symbol for an id returned by intern() or find(). */
+const Symbol& SymbolTable::get(SymbolId id) const {
+	return slot(id);
+}
+
+/* Returns the slot holding the symbol with the id. */
+Symbol& SymbolTable::slot(SymbolId id) const {
+	return chunks[id / SYMBOL_CHUNK_SIZE].load()[id % SYMBOL_CHUNK_SIZE];
+}
+
+/* Returns the lowercase form of the name. */
+string SymbolTable::fold(string name) {
+	transform(name.begin(), name.end(), name.begin(), ::tolower);
+	return name;
+}
+
+/* Interns the name and takes a reference to it, the mutex must already be held.
+	Ids given up by released symbols are reused first. Chunks are only ever appended, so readers that were handed an id can index into them without taking the mutex.
+*/
+SymbolId SymbolTable::internLocked(const string& name) {
+	auto found = ids.find(name);
+	if(found != ids.end()) {
+		slot(found->second).references++;
+		return found->second;
+	}
+	string folded = fold(name);
+	SymbolId foldedId = (folded == name ? NO_SYMBOL : internLocked(folded));
+	SymbolId id;
+	if(!freeIds.empty()) {
+		id = freeIds.back();
+		freeIds.pop_back();
+	} else {
+		if(count >= (SymbolId)SYMBOL_CHUNK_SIZE * SYMBOL_CHUNK_COUNT) {
+			if(foldedId != NO_SYMBOL)
+				releaseLocked(foldedId);
+			throw runtime_error("Symbol table is full.");
+		}
+		id = count++;
+		if(chunks[id / SYMBOL_CHUNK_SIZE].load() == nullptr)
+			chunks[id / SYMBOL_CHUNK_SIZE].store(new Symbol[SYMBOL_CHUNK_SIZE]);
+	}
+	Symbol& symbol = slot(id);
+	symbol.id = id;
+	symbol.foldedId = (foldedId == NO_SYMBOL ? id : foldedId);
+	symbol.name = name;
+	symbol.folded = folded;
+	symbol.hash = hash<string>()(folded);
+	symbol.references = 1;
+	ids[name] = id;
+	return id;
+}
+
+/* Gives back a reference, removing the symbol and freeing its id once it has none left. The mutex must already be held. */
+void SymbolTable::releaseLocked(SymbolId id) {
+	Symbol& symbol = slot(id);
+	if(--symbol.references > 0)
+		return;
+	ids.erase(symbol.name);
+	if(symbol.foldedId != id)
+		releaseLocked(symbol.foldedId);
+	symbol.name.clear();
+	symbol.folded.clear();
+	freeIds.push_back(id);
+}
+
+SymbolTable::~SymbolTable() {
+	for(unsigned int i = 0; i < SYMBOL_CHUNK_COUNT; i++) {
+		delete[] chunks[i].load();
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef SYMBOL_TABLE_H_
+#define SYMBOL_TABLE_H_
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#define SYMBOL_CHUNK_SIZE 1024
+#define SYMBOL_CHUNK_COUNT 1024
+#define NO_SYMBOL 0xFFFFFFFF
+#define EMPTY_SYMBOL 0
+typedef unsigned int SymbolId;
+
+/* An interned name. The case folded form is interned as well so case insensitive comparisons only need to compare foldedId.
+	references counts the holders of the symbol, a symbol whose folded form is a different name holds a reference to it.
+*/
+struct Symbol {
+	SymbolId id;
+	SymbolId foldedId;
+	size_t hash;
+	std::string name;
+	std::string folded;
+	unsigned int references;
+};
+
+/* Maps usernames and room names to ids, keeping a single copy of every distinct name.
+	Every intern() or retain() takes a reference that must be given back with release(). Once nothing references a symbol it is removed and its id is reused,
+	so clients making up room and user names can't fill the table.
+	Symbols live in chunks that are never freed, so references returned by get() stay valid and can be read without locking while the caller holds a reference.
+*/
+class SymbolTable {
+public:
+	SymbolTable();
+	~SymbolTable();
+	SymbolId intern(const std::string& name);
+	void retain(SymbolId id);
+	void release(SymbolId id);
+	SymbolId find(const std::string& name);
+	const Symbol& get(SymbolId id) const;
+	static std::string fold(std::string name);
+private:
+	SymbolId internLocked(const std::string& name);
+	void releaseLocked(SymbolId id);
+	Symbol& slot(SymbolId id) const;
+	std::mutex mtx;
+	std::unordered_map<std::string, SymbolId> ids;
+	std::atomic<Symbol*> chunks[SYMBOL_CHUNK_COUNT];
+	std::vector<SymbolId> freeIds;
+	SymbolId count;
+};
+#endif //SYMBOL_TABLE_H_
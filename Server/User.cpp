@@ -2,9 +2,9 @@
 #include "Room.h"
 #include "Server.h"
 #include "Constants.h"
+#include "UserTable.h"
 #include <iostream>
 #include <winsock2.h>
-#include <fstream>
 
 using namespace std;
 
@@ -12,16 +12,14 @@ User::User(Server* server, unsigned short userId, SOCKET socket) :
 	server(server),
 	room(nullptr),
 	userId(userId),
-	username(""),
-	usernameLowercase(""),
+	name(&server->getSymbolTable().get(EMPTY_SYMBOL)),
 	password(""),
 	verified(false),
-	authenticated(false),
+	memberListVersion(0),
 	friendsList{nullptr},
-	userNameColor(DEFAULT_COLOR),
-	userChatColor(DEFAULT_CHAT_COLOR),
 	packetHandler(new PacketHandler(server, this, socket)),
-	replyUsername("") {
+	replyUsername(""),
+	resumeToken("") {
 	sockaddr_in socketAddr;
 	int addrLen = sizeof(socketAddr);
 	if(getsockname(socket, (LPSOCKADDR)&socketAddr, &addrLen) == SOCKET_ERROR) {
@@ -46,20 +44,27 @@ unsigned short User::getUserId() const {
 }
 
 /* Returns the user's name. */
-string User::getUsername() const {
-	return username;
+const string& User::getUsername() const {
+	return name->name;
 }
 
 /* Returns the user's name in lowercase */
-string User::getUsernameLowercase() const {
-	return usernameLowercase;
+const string& User::getUsernameLowercase() const {
+	return name->folded;
 }
 
-/* Set the user's name. */
+/* Returns the interned symbol of the user's name. */
+const Symbol& User::getNameSymbol() const {
+	return *name;
+}
+
+/* Set the user's name, giving back the reference to the name they had before. */
 void User::setUsername(string username) {
-	this->username = username;
-	this->usernameLowercase.resize(username.size());
-	transform(username.begin(), username.end(), usernameLowercase.begin(), ::tolower);
+	SymbolTable& symbolTable = server->getSymbolTable();
+	SymbolId oldNameId = name->id;
+	name = &symbolTable.get(symbolTable.intern(username));
+	server->getUserTable().setName(userId, name->foldedId);
+	symbolTable.release(oldNameId);
 }
 
 /* Returns the user's password. */
@@ -85,35 +90,37 @@ void User::setVerified(bool verified) {
 
 /* Set if the user is authenticated. */
 void User::setAuthenticated(bool authenticated) {
-	this->authenticated = authenticated;
+	server->getUserTable().setAuthenticated(userId, authenticated);
 }
 
 /* Returns if the user is authenticated. */
 bool User::isAuthenticated() const {
-	return authenticated;
+	return server->getUserTable().isAuthenticated(userId);
 }
 
 /* Set the user's name color. */
 void User::setUserNameColor(unsigned short userNameColor) {
-	this->userNameColor = userNameColor;
+	server->getUserTable().setNameColor(userId, userNameColor);
+	if(getRoom() != nullptr)
+		getRoom()->memberRecolored(this);
 	save();
 
 }
 
 /* Set the user's chat color. */
 void User::setUserChatColor(unsigned short userChatColor) {
-	this->userChatColor = userChatColor;
+	server->getUserTable().setChatColor(userId, userChatColor);
 	save();
 }
 
 /* Return the user's name color. */
 unsigned short User::getUserNameColor() const {
-	return userNameColor;
+	return server->getUserTable().getNameColor(userId);
 }
 
 /* Return the user's chat color. */
 unsigned short User::getUserChatColor() const {
-	return userChatColor;
+	return server->getUserTable().getChatColor(userId);
 }
 
 /* Return the packet handler instance. */
@@ -129,27 +136,34 @@ Room* User::getRoom() const {
 /* Set the room the user is inside. */
 void User::setRoom(Room* const room) {
 	this->room = room;
+	server->getUserTable().setRoomId(userId, room == nullptr ? NO_ROOM_ID : room->getRoomId());
+	server->markSessionsChanged();
 }
 
 /* Returns true if the name is on the user's friends list, otherwise false. */
 bool User::isFriend(std::string name) {
-	transform(name.begin(), name.end(), name.begin(), ::tolower);
-	for(int i = 0; i < MAX_FRIENDS; i++) {
-		if(friendsList[i] == nullptr)
-			continue;
-		if(name == friendsList[i]->getLowercaseName())
-			return true;
-	}
-	return false;
+	return getFriend(name) != nullptr;
+}
+
+/* Returns true if the interned lowercase name is on the user's friends list, otherwise false. */
+bool User::isFriend(SymbolId foldedNameId) {
+	return getFriend(foldedNameId) != nullptr;
 }
 
 /* Returns the user's friend is found, otherwise nullptr. */
 Friend* const User::getFriend(std::string name) {
-	transform(name.begin(), name.end(), name.begin(), ::tolower);
+	SymbolId foldedNameId = server->getSymbolTable().find(SymbolTable::fold(name));
+	if(foldedNameId == NO_SYMBOL)
+		return nullptr;
+	return getFriend(foldedNameId);
+}
+
+/* Returns the user's friend with the interned lowercase name if found, otherwise nullptr. */
+Friend* const User::getFriend(SymbolId foldedNameId) {
 	for(int i = 0; i < MAX_FRIENDS; i++) {
 		if(friendsList[i] == nullptr)
 			continue;
-		if(name == friendsList[i]->getLowercaseName())
+		if(friendsList[i]->getFoldedId() == foldedNameId)
 			return friendsList[i];
 	}
 	return nullptr;
@@ -162,13 +176,17 @@ Friend* const User::getFriend(std::string name) {
 bool User::addFriend(std::string name) {
 	for(int i = 0; i < MAX_FRIENDS; i++) {
 		if(friendsList[i] == nullptr) {
-			friendsList[i] = new Friend(server->getUserByName(name), name);
+			SymbolTable& symbolTable = server->getSymbolTable();
+			friendsList[i] = new Friend(nullptr, symbolTable.get(symbolTable.intern(name)));
+			setFriendSession(friendsList[i], server->getUserBySymbol(friendsList[i]->getFoldedId()));
+			server->addFriendReference(this, friendsList[i]);
 			Packet* p = packetHandler->constructPacket(ADD_FRIEND_PACKET_ID);
 			*p << friendsList[i]->getName();
 			*p << friendsList[i]->isOnline();
 			packetHandler->finializePacket(p);
-			if(getRoom() != nullptr)
-				getRoom()->updateRoomList(this);
+			User* friendUser = friendsList[i]->getActiveUser();
+			if(getRoom() != nullptr && friendUser != nullptr && friendUser->getRoom() == getRoom())
+				getRoom()->sendMemberDelta(this, ROOM_MEMBER_RECOLORED, friendUser);
 			save();
 			return true;
 		}
@@ -181,16 +199,23 @@ bool User::addFriend(std::string name) {
 	- Returns true if the friend was removed from their list.  (Also updates the room list incase their friend is inside)
 */
 bool User::removeFriend(std::string name) {
-	transform(name.begin(), name.end(), name.begin(), ::tolower);
+	SymbolId foldedNameId = server->getSymbolTable().find(SymbolTable::fold(name));
+	if(foldedNameId == NO_SYMBOL)
+		return false;
 	for(int i = 0; i < MAX_FRIENDS; i++) {
-		if(friendsList[i] != nullptr && friendsList[i]->getLowercaseName() == name) {
+		if(friendsList[i] != nullptr && friendsList[i]->getFoldedId() == foldedNameId) {
+			User* friendUser = friendsList[i]->getActiveUser();
+			SymbolId friendNameId = friendsList[i]->getNameId();
+			server->removeFriendReference(this, friendsList[i]);
+			setFriendSession(friendsList[i], nullptr);
 			delete friendsList[i];
 			friendsList[i] = nullptr;
 			Packet* p = packetHandler->constructPacket(REMOVE_FRIEND_PACKET_ID);
-			*p << name;
+			*p << server->getSymbolTable().get(foldedNameId).name;
 			packetHandler->finializePacket(p);
-			if(getRoom() != nullptr)
-				getRoom()->updateRoomList(this);
+			server->getSymbolTable().release(friendNameId); //Held the folded name until the packet was written.
+			if(getRoom() != nullptr && friendUser != nullptr && friendUser->getRoom() == getRoom())
+				getRoom()->sendMemberDelta(this, ROOM_MEMBER_RECOLORED, friendUser);
 			save();
 			return true;
 		}
@@ -198,14 +223,14 @@ bool User::removeFriend(std::string name) {
 	return false;
 }
 
-void User::updateFriendStatus(User* const friendUser, Friend* const friendEntry) {
-	friendEntry->setActiveUser(friendUser->getPacketHandler()->isConnected() ? friendUser : nullptr);
-
-	Packet* p = packetHandler->constructPacket(FRIEND_STATUS_PACKET_ID);
-	*p << friendEntry->getName();
-	*p << friendEntry->isOnline();
-	packetHandler->finializePacket(p);
-	sendMessage(friendUser, "has just " + (string)(friendEntry->isOnline() ? "logged on." : "logged off."), true, false, false);
+/* Points the friend entry at the friend's online session (or nullptr) and keeps the user's friend mask in sync with it. */
+void User::setFriendSession(Friend* const friendEntry, User* const friendUser) {
+	UserTable& userTable = server->getUserTable();
+	if(friendEntry->getActiveUser() != nullptr)
+		userTable.setFriendBit(userId, friendEntry->getActiveUser()->getUserId(), false);
+	friendEntry->setActiveUser(friendUser);
+	if(friendUser != nullptr)
+		userTable.setFriendBit(userId, friendUser->getUserId(), true);
 }
 
 void User::sendFriendsList() {
@@ -223,6 +248,19 @@ void User::sendFriendsList() {
 	packetHandler->finializePacket(p);
 }
 
+/* Empties the user's friends list and removes them from the server's reverse friend index, giving back the references to their names. */
+void User::clearFriends() {
+	for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
+		if(friendsList[i] == nullptr)
+			continue;
+		server->removeFriendReference(this, friendsList[i]);
+		setFriendSession(friendsList[i], nullptr);
+		server->getSymbolTable().release(friendsList[i]->getNameId());
+		delete friendsList[i];
+		friendsList[i] = nullptr;
+	}
+}
+
 /* Return the user's friends list. */
 Friend** const User::getFriends() {
 	return friendsList;
@@ -230,7 +268,7 @@ Friend** const User::getFriends() {
 
 /* Disconnect the user from the server.
 	We need to properly join or detach the threads depending on what thread called the disconnection.
-	If an authenticated user disconnects it will send a friends list update to anyone that is the user's friend.
+	If an authenticated user disconnects it will send a friends list update to anyone that is the user's friend, and their session is kept resumable for a while.
 */
 void User::disconnect() {
 	packetHandler->setConnected(false);
@@ -244,6 +282,7 @@ void User::disconnect() {
 		writeThreadInstance.detach();
 	if(isAuthenticated()) {
 		save();
+		server->keepResumableSession(this);
 		if(getRoom() != nullptr)
 			getRoom()->leaveRoom(this);
 		server->handleFriendStatusUpdate(this);
@@ -284,35 +323,24 @@ unsigned short User::load(string username) {
 	if(username.empty() || !isVerified())
 		return LOAD_FAILURE;
 	transform(username.begin(), username.end(), username.begin(), ::tolower);
-	ifstream userFile;
+	UserRecord record;
 	try {
-		userFile.open(SAVE_DIRECTORY + username + ".txt");
-		if(userFile.is_open()) {
-			unsigned short version = 0;
-			userFile >> version;
-			switch(version) {
-				case 2:
-					userFile >> this->username;
-					usernameLowercase.resize(this->username.size());
-					transform(this->username.begin(), this->username.end(), usernameLowercase.begin(), ::tolower);
-					userFile >> userNameColor;
-					userFile >> userChatColor;
-					userFile >> password;
-					for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
-						string friendsName;
-						userFile >> friendsName;
-						if(!friendsName.empty())
-							friendsList[i] = new Friend(server->getUserByName(friendsName), friendsName);
-					}
-					break;
-				default:
-					throw exception("Unsupported file version");
+		if(!server->findUserRecord(username, record))
+			return LOAD_NEW_USER;
+		setUsername(record.name);
+		server->getUserTable().setNameColor(userId, record.nameColor);
+		server->getUserTable().setChatColor(userId, record.chatColor);
+		password = record.password;
+		clearFriends();
+		SymbolTable& symbolTable = server->getSymbolTable();
+		for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
+			if(!record.friends[i].empty()) {
+				friendsList[i] = new Friend(nullptr, symbolTable.get(symbolTable.intern(record.friends[i])));
+				setFriendSession(friendsList[i], server->getUserBySymbol(friendsList[i]->getFoldedId()));
+				server->addFriendReference(this, friendsList[i]);
 			}
-			userFile.close();
-			code = LOAD_SUCCESS;
-		} else {
-			code = LOAD_NEW_USER;
 		}
+		code = LOAD_SUCCESS;
 	} catch(exception e) {
 		code = LOAD_FAILURE;
 		cout << "Failure loading " << username << "'s user file: " << e.what();
@@ -322,26 +350,18 @@ unsigned short User::load(string username) {
 
 /* Saves the user data. */
 void User::save() {
-	if(usernameLowercase.empty() || !isVerified())
+	if(getUsernameLowercase().empty() || !isVerified())
 		return;
-	ofstream userFile;
-	try {
-		userFile.open(SAVE_DIRECTORY + usernameLowercase + ".txt");
-		if(!userFile.is_open()) {
-			throw exception("Could not open file to save.");
-		}
-		userFile << (unsigned short)2 << endl; //File version
-		userFile << username << endl;
-		userFile << userNameColor << endl;
-		userFile << userChatColor << endl;
-		userFile << password << endl;
-		for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
-			userFile << (friendsList[i] == nullptr ? "" : friendsList[i]->getName()) << endl;
-		}
-		userFile.close();
-	} catch(exception e) {
-		cout << e.what();
+	UserRecord record;
+	record.name = getUsername();
+	record.nameColor = getUserNameColor();
+	record.chatColor = getUserChatColor();
+	record.password = password;
+	for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
+		if(friendsList[i] != nullptr)
+			record.friends[i] = friendsList[i]->getName();
 	}
+	server->saveUserRecord(getUsernameLowercase(), record);
 }
 
 /* Returns the user's IP address. */
@@ -357,9 +377,25 @@ void User::setReplyUsername(string name) {
 	replyUsername = name;
 }
 
+/* Returns the token this session can be resumed with, empty until one has been issued. */
+const string& User::getResumeToken() const {
+	return resumeToken;
+}
+
+/* Sets the token this session can be resumed with, see Server::issueResumeToken(). */
+void User::setResumeToken(string resumeToken) {
+	this->resumeToken = resumeToken;
+}
+
+/* Advances and returns the version of the room member list this user has been sent.
+	Must be called while constructing the packet carrying it so the versions go out in order.
+*/
+unsigned int User::nextMemberListVersion() {
+	return ++memberListVersion;
+}
+
 User::~User() {
-	for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
-		delete friendsList[i];
-	}
+	clearFriends();
+	server->getSymbolTable().release(name->id);
 	delete packetHandler;
 }
@@ -4,6 +4,7 @@
 #include "Packet/PacketHandler.h"
 #include <winsock2.h>
 #include "Friend.h"
+#include "SymbolTable.h"
 class Server;
 class Room;
 
@@ -13,9 +14,10 @@ public:
 	~User();
 	Room* getRoom() const;
 	void setRoom(Room* const room);
-	std::string getUsername() const;
+	const std::string& getUsername() const;
 	void setUsername(std::string username);
-	std::string getUsernameLowercase() const;
+	const std::string& getUsernameLowercase() const;
+	const Symbol& getNameSymbol() const;
 	std::string getPassword() const;
 	void setPassword(std::string password);
 	bool isVerified() const;
@@ -31,13 +33,19 @@ public:
 	void save();
 	void disconnect();
 	bool isFriend(std::string name);
+	bool isFriend(SymbolId foldedNameId);
 	bool addFriend(std::string name);
 	bool removeFriend(std::string name);
 	Friend* const getFriend(std::string name);
-	void updateFriendStatus(User* const friendUser, Friend* const friendEntry);
+	Friend* const getFriend(SymbolId foldedNameId);
+	void clearFriends();
+	void setFriendSession(Friend* const friendEntry, User* const friendUser);
 	void sendFriendsList();
 	void setReplyUsername(std::string name);
+	unsigned int nextMemberListVersion();
 	std::string getReplyUsername();
+	const std::string& getResumeToken() const;
+	void setResumeToken(std::string resumeToken);
 	std::string getIp();
 	Friend** const getFriends();
 	PacketHandler* getPacketHandler();
@@ -47,18 +55,16 @@ private:
 	Server* server;
 	Room* room;
 	unsigned short userId;
-	unsigned short userNameColor;
-	unsigned short userChatColor;
 	PacketHandler* packetHandler;
 	std::thread readThreadInstance;
 	std::thread writeThreadInstance;
-	std::string username;
-	std::string usernameLowercase;
+	const Symbol* name;
 	std::string password;
 	std::string replyUsername;
+	std::string resumeToken;
 	Friend* friendsList[MAX_FRIENDS];
 	std::string ip;
 	bool verified;
-	bool authenticated;
+	unsigned int memberListVersion;
 };
 #endif //USER_H_
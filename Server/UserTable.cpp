@@ -0,0 +1,112 @@
+#include "UserTable.h"
+using namespace std;
+
+UserTable::UserTable() {
+	for(unsigned short i = 0; i < MAX_USERS; i++) {
+		clear(i);
+	}
+}
+
+/* Puts the slot into the state of a freshly connected user. */
+void UserTable::reset(unsigned short userId) {
+	flags[userId] = USER_FLAG_ONLINE;
+	roomIds[userId] = NO_ROOM_ID;
+	nameColors[userId] = DEFAULT_COLOR;
+	chatColors[userId] = DEFAULT_CHAT_COLOR;
+	nameIds[userId] = NO_SYMBOL;
+}
+
+/* Marks the slot as unused.
+	The slot's friend mask is emptied and its bit is removed from everyone else's mask so a later session in the same slot doesn't inherit it.
+*/
+void UserTable::clear(unsigned short userId) {
+	reset(userId);
+	flags[userId] = 0;
+	lock_guard<mutex> lock(friendMaskMutex);
+	friendMasks[userId].reset();
+	for(unsigned short i = 0; i < MAX_USERS; i++) {
+		friendMasks[i].reset(userId);
+	}
+}
+
+/* Returns true if a user is connected in the slot. */
+bool UserTable::isOnline(unsigned short userId) const {
+	return (flags[userId] & USER_FLAG_ONLINE) != 0;
+}
+
+/* Set if the user in the slot is authenticated. */
+void UserTable::setAuthenticated(unsigned short userId, bool authenticated) {
+	if(authenticated)
+		flags[userId].fetch_or(USER_FLAG_AUTHENTICATED);
+	else
+		flags[userId].fetch_and((unsigned char)~USER_FLAG_AUTHENTICATED);
+}
+
+/* Returns if the user in the slot is authenticated. */
+bool UserTable::isAuthenticated(unsigned short userId) const {
+	return (flags[userId] & USER_FLAG_AUTHENTICATED) != 0;
+}
+
+/* Set the id of the room the user is inside (NO_ROOM_ID if not in one). */
+void UserTable::setRoomId(unsigned short userId, unsigned short roomId) {
+	roomIds[userId] = roomId;
+}
+
+/* Returns the id of the room the user is inside (NO_ROOM_ID if not in one). */
+unsigned short UserTable::getRoomId(unsigned short userId) const {
+	return roomIds[userId];
+}
+
+/* Set the user's name color. */
+void UserTable::setNameColor(unsigned short userId, unsigned short color) {
+	nameColors[userId] = color;
+}
+
+/* Returns the user's name color. */
+unsigned short UserTable::getNameColor(unsigned short userId) const {
+	return nameColors[userId];
+}
+
+/* Set the user's chat color. */
+void UserTable::setChatColor(unsigned short userId, unsigned short color) {
+	chatColors[userId] = color;
+}
+
+/* Returns the user's chat color. */
+unsigned short UserTable::getChatColor(unsigned short userId) const {
+	return chatColors[userId];
+}
+
+/* Stores the interned id of the user's lowercase name so name lookups only compare ids. */
+void UserTable::setName(unsigned short userId, SymbolId foldedNameId) {
+	nameIds[userId] = foldedNameId;
+}
+
+/* Returns the interned id of the user's lowercase name. */
+SymbolId UserTable::getNameId(unsigned short userId) const {
+	return nameIds[userId];
+}
+
+/* Finds the authenticated slot whose lowercase name has the id.
+	Returns the user id, or -1 if nobody matched.
+*/
+int UserTable::findAuthenticated(SymbolId foldedNameId) const {
+	for(unsigned short i = 0; i < MAX_USERS; i++) {
+		if((flags[i] & USER_FLAG_AUTHENTICATED) && nameIds[i] == foldedNameId)
+			return i;
+	}
+	return -1;
+}
+
+/* Sets or clears the bit for the friend's session inside the user's friend mask. */
+void UserTable::setFriendBit(unsigned short userId, unsigned short friendId, bool online) {
+	lock_guard<mutex> lock(friendMaskMutex);
+	friendMasks[userId].set(friendId, online);
+}
+
+/* Returns a copy of the set of sessions that are online friends of the user, taken under the lock so it can't tear against a concurrent update. */
+bitset<MAX_USERS> UserTable::getFriendMask(unsigned short userId) const {
+	lock_guard<mutex> lock(friendMaskMutex);
+	return friendMasks[userId];
+}
+
@@ -0,0 +1,46 @@
+#ifndef USER_TABLE_H_
+#define USER_TABLE_H_
+#include "Constants.h"
+#include <string>
+#include <bitset>
+#include <mutex>
+#include <atomic>
+#include "SymbolTable.h"
+#define USER_FLAG_ONLINE 1
+#define USER_FLAG_AUTHENTICATED 2
+#define NO_ROOM_ID 0xFFFF
+
+/* Holds the per-session fields that get scanned across every user slot, stored as contiguous columns indexed by user id.
+	Anything that is only needed once a user has been found (password, reply name, friends) stays inside the User object.
+	The flags are set from the reader threads while the tick thread scans them, so each slot's flags are atomic and updated with a single read-modify-write.
+	The friend masks are written from every reader thread and from the slot cleanup, so they are only touched under friendMaskMutex.
+*/
+class UserTable {
+public:
+	UserTable();
+	void reset(unsigned short userId);
+	void clear(unsigned short userId);
+	bool isOnline(unsigned short userId) const;
+	void setAuthenticated(unsigned short userId, bool authenticated);
+	bool isAuthenticated(unsigned short userId) const;
+	void setRoomId(unsigned short userId, unsigned short roomId);
+	unsigned short getRoomId(unsigned short userId) const;
+	void setNameColor(unsigned short userId, unsigned short color);
+	unsigned short getNameColor(unsigned short userId) const;
+	void setChatColor(unsigned short userId, unsigned short color);
+	unsigned short getChatColor(unsigned short userId) const;
+	void setName(unsigned short userId, SymbolId foldedNameId);
+	SymbolId getNameId(unsigned short userId) const;
+	int findAuthenticated(SymbolId foldedNameId) const;
+	void setFriendBit(unsigned short userId, unsigned short friendId, bool online);
+	std::bitset<MAX_USERS> getFriendMask(unsigned short userId) const;
+private:
+	std::atomic<unsigned char> flags[MAX_USERS];
+	unsigned short roomIds[MAX_USERS];
+	unsigned short nameColors[MAX_USERS];
+	unsigned short chatColors[MAX_USERS];
+	SymbolId nameIds[MAX_USERS];
+	std::bitset<MAX_USERS> friendMasks[MAX_USERS];
+	mutable std::mutex friendMaskMutex;
+};
+#endif //USER_TABLE_H_
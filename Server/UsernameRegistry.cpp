@@ -0,0 +1,62 @@
+#include "UsernameRegistry.h"
+#include "SymbolTable.h"
+#include "Storage/BinaryCodec.h"
+using namespace std;
+
+UsernameRegistry::UsernameRegistry() :
+	bloom(REGISTRY_BLOOM_BITS / 8, 0),
+	loaded(false) {}
+
+/* Registers the name, keeping the first casing seen if it is already registered. */
+void UsernameRegistry::add(const string& canonicalName) {
+	string folded = SymbolTable::fold(canonicalName);
+	size_t positions[REGISTRY_BLOOM_HASHES];
+	bloomPositions(folded, positions);
+	lock_guard<mutex> lock(mtx);
+	names.emplace(folded, canonicalName);
+	for(size_t position : positions) {
+		bloom[position / 8] |= (unsigned char)(1 << (position % 8));
+	}
+}
+
+/* Looks up the name in any case, giving back the name as it was registered. Returns false if it isn't registered (or not loaded yet). */
+bool UsernameRegistry::find(const string& name, string& canonicalName) {
+	string folded = SymbolTable::fold(name);
+	size_t positions[REGISTRY_BLOOM_HASHES];
+	bloomPositions(folded, positions);
+	lock_guard<mutex> lock(mtx);
+	for(size_t position : positions) {
+		if((bloom[position / 8] & (1 << (position % 8))) == 0)
+			return false;
+	}
+	auto it = names.find(folded);
+	if(it == names.end())
+		return false;
+	canonicalName = it->second;
+	return true;
+}
+
+/* Marks the startup load as finished, from here on a miss means the name has never been registered. */
+void UsernameRegistry::setLoaded() {
+	loaded = true;
+}
+
+/* Returns if the startup load has finished. */
+bool UsernameRegistry::isLoaded() const {
+	return loaded;
+}
+
+/* Returns how many names are registered. */
+size_t UsernameRegistry::size() {
+	lock_guard<mutex> lock(mtx);
+	return names.size();
+}
+
+/* Picks the filter bits for a name by double hashing two independent hashes of it. */
+void UsernameRegistry::bloomPositions(const string& folded, size_t (&positions)[REGISTRY_BLOOM_HASHES]) const {
+	size_t first = hash<string>()(folded);
+	size_t second = checksum(folded.data(), folded.size()) | 1;
+	for(size_t i = 0; i < REGISTRY_BLOOM_HASHES; i++) {
+		positions[i] = (first + i * second) % REGISTRY_BLOOM_BITS;
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef USERNAME_REGISTRY_H_
+#define USERNAME_REGISTRY_H_
+#include "Constants.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+/* Every registered username, kept in memory as a map from the case folded name to the name as it was registered.
+	A Bloom filter in front of the map answers most lookups for names that were never registered without touching the map.
+	The registry is filled in the background at startup; until setLoaded() is called a miss doesn't mean the name is free.
+*/
+class UsernameRegistry {
+public:
+	UsernameRegistry();
+	void add(const std::string& canonicalName);
+	bool find(const std::string& name, std::string& canonicalName);
+	void setLoaded();
+	bool isLoaded() const;
+	size_t size();
+private:
+	void bloomPositions(const std::string& folded, size_t (&positions)[REGISTRY_BLOOM_HASHES]) const;
+	std::unordered_map<std::string, std::string> names;
+	std::vector<unsigned char> bloom;
+	std::atomic<bool> loaded;
+	std::mutex mtx;
+};
+#endif //USERNAME_REGISTRY_H_
@@ -0,0 +1,296 @@
+#include "../../Server/Constants.h"
+#include "../../Server/Storage/ColumnarFormat.h"
+#include <windows.h>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <ctime>
+using namespace std;
+
+/* The filters and output asked for on the command line. Empty strings and -1 times mean no filter. */
+struct Query {
+	long long from = -1;
+	long long to = -1;
+	string room;
+	string user;
+	int type = -1;
+	string contains;
+	bool count = false;
+	string groupBy;
+};
+
+/* What the query had to read, printed at the end. */
+struct QueryStats {
+	unsigned long long files = 0;
+	unsigned long long filesSkipped = 0;
+	unsigned long long blocks = 0;
+	unsigned long long blocksSkipped = 0;
+	unsigned long long rows = 0;
+	unsigned long long matched = 0;
+	unsigned long long bytes = 0;
+	unsigned long long corrupt = 0;
+};
+
+/* Lowercases a copy of the text. */
+static string lowercase(string text) {
+	transform(text.begin(), text.end(), text.begin(), ::tolower);
+	return text;
+}
+
+/* Parses a yyyy-mm-dd date as local midnight. Returns -1 if it isn't a date. */
+static long long parseDate(const string& date) {
+	tm local = {};
+	if(date.length() != 10 || date[4] != '-' || date[7] != '-')
+		return -1;
+	try {
+		local.tm_year = stoi(date.substr(0, 4)) - 1900;
+		local.tm_mon = stoi(date.substr(5, 2)) - 1;
+		local.tm_mday = stoi(date.substr(8, 2));
+	} catch(exception&) {
+		return -1;
+	}
+	local.tm_isdst = -1;
+	return (long long)mktime(&local);
+}
+
+/* Formats a time as local yyyy-mm-dd hh:mm:ss, or just the date. */
+static string formatTime(long long time, bool dateOnly) {
+	time_t seconds = (time_t)time;
+	tm local;
+	if(localtime_s(&local, &seconds) != 0)
+		return "?";
+	char formatted[32];
+	strftime(formatted, sizeof(formatted), dateOnly ? "%Y-%m-%d" : "%Y-%m-%d %H:%M:%S", &local);
+	return formatted;
+}
+
+/* Marks the entries of a block dictionary equal to the name ignoring case. Returns how many there are. */
+static size_t matchDictionary(const vector<string>& dictionary, const string& lowercaseName, vector<bool>& matches) {
+	size_t found = 0;
+	matches.assign(dictionary.size(), false);
+	for(size_t i = 0; i < dictionary.size(); i++) {
+		if(lowercase(dictionary[i]) == lowercaseName) {
+			matches[i] = true;
+			found++;
+		}
+	}
+	return found;
+}
+
+/* Checks the block stats against the query, so blocks that can't hold a match are skipped without decoding any column. */
+static bool mayMatch(const BlockStats& stats, const Query& query, vector<bool>& roomMatches, vector<bool>& userMatches) {
+	if(query.from != -1 && stats.maxTime < query.from)
+		return false;
+	if(query.to != -1 && stats.minTime >= query.to)
+		return false;
+	if(query.type != -1 && !(stats.typeMask & (1 << query.type)))
+		return false;
+	if(!query.room.empty() && matchDictionary(stats.rooms, query.room, roomMatches) == 0)
+		return false;
+	if(!query.user.empty() && matchDictionary(stats.users, query.user, userMatches) == 0)
+		return false;
+	return true;
+}
+
+/* Runs the query over one block, decoding only the columns the filters and the output need.
+	Each filter narrows the list of selected rows, so later columns are only looked at for rows still in the running.
+*/
+static void queryBlock(const ColumnBlock& block, const Query& query, const vector<bool>& roomMatches, const vector<bool>& userMatches, QueryStats& stats, unordered_map<string, unsigned long long>& groups) {
+	const BlockStats& blockStats = block.getStats();
+	vector<unsigned int> selected(blockStats.rowCount);
+	for(unsigned int i = 0; i < blockStats.rowCount; i++) {
+		selected[i] = i;
+	}
+	auto narrow = [&selected](const function<bool(unsigned int)>& keep) {
+		selected.erase(remove_if(selected.begin(), selected.end(), [&keep](unsigned int row) { return !keep(row); }), selected.end());
+	};
+	vector<long long> times;
+	bool needTimes = (query.from != -1 && blockStats.minTime < query.from) || (query.to != -1 && blockStats.maxTime >= query.to) || (!query.count && (query.groupBy.empty() || query.groupBy == "day"));
+	if(needTimes) {
+		times = block.readTimes();
+		if(query.from != -1 || query.to != -1)
+			narrow([&](unsigned int row) { return (query.from == -1 || times[row] >= query.from) && (query.to == -1 || times[row] < query.to); });
+	}
+	vector<unsigned char> types;
+	if(query.type != -1 && blockStats.typeMask != (1 << query.type)) {
+		types = block.readTypes();
+		narrow([&](unsigned int row) { return types[row] == query.type; });
+	}
+	vector<unsigned int> rooms;
+	bool filterRooms = !query.room.empty() && count(roomMatches.begin(), roomMatches.end(), true) < (long long)roomMatches.size();
+	if(filterRooms || query.groupBy == "room" || (!query.count && query.groupBy.empty())) {
+		rooms = block.readRooms();
+		if(filterRooms)
+			narrow([&](unsigned int row) { return roomMatches[rooms[row]]; });
+	}
+	vector<unsigned int> users;
+	bool filterUsers = !query.user.empty() && count(userMatches.begin(), userMatches.end(), true) < (long long)userMatches.size();
+	if(filterUsers || query.groupBy == "user" || (!query.count && query.groupBy.empty())) {
+		users = block.readUsers();
+		if(filterUsers)
+			narrow([&](unsigned int row) { return userMatches[users[row]]; });
+	}
+	vector<string> texts;
+	if(!query.contains.empty() || (!query.count && query.groupBy.empty())) {
+		texts = block.readTexts();
+		if(!query.contains.empty())
+			narrow([&](unsigned int row) { return lowercase(texts[row]).find(query.contains) != string::npos; });
+	}
+	if(query.groupBy == "type" && types.empty())
+		types = block.readTypes();
+	stats.matched += selected.size();
+	if(query.count)
+		return;
+	for(unsigned int row : selected) {
+		if(query.groupBy == "room")
+			groups[blockStats.rooms[rooms[row]]]++;
+		else if(query.groupBy == "user")
+			groups[blockStats.users[users[row]]]++;
+		else if(query.groupBy == "type")
+			groups[types[row] == EXPORT_EVENT_CHAT ? "chat" : "command"]++;
+		else if(query.groupBy == "day")
+			groups[formatTime(times[row], true)]++;
+		else
+			cout << formatTime(times[row], false) << " <" << blockStats.rooms[rooms[row]] << "> " << blockStats.users[users[row]] << ": " << texts[row] << endl;
+	}
+}
+
+/* Reads every block in an export file, skipping what the block stats rule out. A torn or corrupted block ends the file. */
+static void queryFile(const string& path, const Query& query, QueryStats& stats, unordered_map<string, unsigned long long>& groups) {
+	ifstream exportFile(path, ios::binary);
+	if(!exportFile.is_open()) {
+		cerr << "Could not open " << path << endl;
+		return;
+	}
+	string data((istreambuf_iterator<char>(exportFile)), istreambuf_iterator<char>());
+	stats.files++;
+	stats.bytes += data.size();
+	size_t offset = 0;
+	while(offset < data.size()) {
+		ColumnBlock block;
+		size_t length = 0;
+		if(!block.open(data.data() + offset, data.size() - offset, length)) {
+			stats.corrupt++;
+			cerr << path << " ends with an unreadable block at byte " << offset << "." << endl;
+			return;
+		}
+		offset += length;
+		stats.blocks++;
+		stats.rows += block.getStats().rowCount;
+		vector<bool> roomMatches;
+		vector<bool> userMatches;
+		if(!mayMatch(block.getStats(), query, roomMatches, userMatches)) {
+			stats.blocksSkipped++;
+			continue;
+		}
+		try {
+			if(!block.verify())
+				throw exception("Checksum mismatch");
+			queryBlock(block, query, roomMatches, userMatches, stats, groups);
+		} catch(exception& e) {
+			stats.corrupt++;
+			cerr << path << ": block at byte " << (offset - length) << " is corrupted (" << e.what() << ")." << endl;
+		}
+	}
+}
+
+/* Queries the columnar event exports the server writes to its export directory.
+	Usage: LogQuery [export directory] [--from yyyy-mm-dd] [--to yyyy-mm-dd] [--room name] [--user name] [--type chat|command] [--contains text] [--count | --group room|user|type|day]
+	Without --count or --group the matching events are printed. --to includes the whole of that day.
+*/
+int main(int argc, char* argv[]) {
+	string directory = EXPORT_DIRECTORY;
+	Query query;
+	for(int i = 1; i < argc; i++) {
+		string argument = argv[i];
+		string value = i + 1 < argc ? argv[i + 1] : "";
+		if(argument == "--count") {
+			query.count = true;
+			continue;
+		} else if(argument.compare(0, 2, "--") != 0) {
+			directory = argument;
+			continue;
+		}
+		if(value.empty()) {
+			cerr << argument << " needs a value." << endl;
+			return 1;
+		}
+		i++;
+		if(argument == "--from" || argument == "--to") {
+			long long date = parseDate(value);
+			if(date == -1) {
+				cerr << "Dates are written as yyyy-mm-dd." << endl;
+				return 1;
+			}
+			if(argument == "--from")
+				query.from = date;
+			else
+				query.to = date + 24 * 60 * 60;
+		} else if(argument == "--room") {
+			query.room = lowercase(value);
+		} else if(argument == "--user") {
+			query.user = lowercase(value);
+		} else if(argument == "--type" && (value == "chat" || value == "command")) {
+			query.type = value == "chat" ? EXPORT_EVENT_CHAT : EXPORT_EVENT_COMMAND;
+		} else if(argument == "--contains") {
+			query.contains = lowercase(value);
+		} else if(argument == "--group" && (value == "room" || value == "user" || value == "type" || value == "day")) {
+			query.groupBy = value;
+		} else {
+			cerr << "Unknown option " << argument << " " << value << endl;
+			return 1;
+		}
+	}
+	if(directory.back() != '/' && directory.back() != '\\')
+		directory += "/";
+
+	string fromDay = query.from == -1 ? "" : formatTime(query.from, true);
+	string toDay = query.to == -1 ? "" : formatTime(query.to - 1, true);
+	fromDay.erase(remove(fromDay.begin(), fromDay.end(), '-'), fromDay.end());
+	toDay.erase(remove(toDay.begin(), toDay.end(), '-'), toDay.end());
+
+	QueryStats stats;
+	unordered_map<string, unsigned long long> groups;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<string> fileNames;
+	WIN32_FIND_DATAA findData;
+	HANDLE search = FindFirstFileA((directory + "events.*.col").c_str(), &findData);
+	if(search != INVALID_HANDLE_VALUE) {
+		do {
+			if(!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				fileNames.push_back(findData.cFileName);
+		} while(FindNextFileA(search, &findData));
+		FindClose(search);
+	}
+	sort(fileNames.begin(), fileNames.end());
+	for(const string& fileName : fileNames) {
+		if(fileName.length() < 19)
+			continue;
+		string day = fileName.substr(7, 8); //events.[yyyymmdd].[run].col
+		if((!fromDay.empty() && day < fromDay) || (!toDay.empty() && day > toDay)) {
+			stats.filesSkipped++;
+			continue;
+		}
+		queryFile(directory + fileName, query, stats, groups);
+	}
+
+	if(query.count) {
+		cout << stats.matched << endl;
+	} else if(!query.groupBy.empty()) {
+		vector<pair<string, unsigned long long>> sorted(groups.begin(), groups.end());
+		sort(sorted.begin(), sorted.end(), [](const pair<string, unsigned long long>& a, const pair<string, unsigned long long>& b) { return a.second > b.second; });
+		for(const auto& group : sorted) {
+			cout << group.second << "\t" << group.first << endl;
+		}
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cerr << stats.matched << " of " << stats.rows << " events matched in " << seconds << "s. ";
+	cerr << "Read " << stats.files << " files (" << (stats.bytes / 1024) << " KB), skipped " << stats.filesSkipped << " files by date and " << stats.blocksSkipped << " of " << stats.blocks << " blocks by their stats." << endl;
+	return stats.corrupt > 0 ? 2 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef BOUNDED_QUEUE_H_
+#define BOUNDED_QUEUE_H_
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/* A fixed capacity queue shared between threads. push() waits while the queue is full so a fast producer can't run away from the consumers.
+	Once close() is called pop() returns false after the remaining items are taken.
+*/
+template <typename T>
+class BoundedQueue {
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+	void push(T item) {
+		std::unique_lock<std::mutex> lock(mtx);
+		notFull.wait(lock, [this]() { return items.size() < capacity; });
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+	}
+
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> lock(mtx);
+		notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+		if(items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> lock(mtx);
+		closed = true;
+		notEmpty.notify_all();
+	}
+private:
+	const size_t capacity;
+	std::deque<T> items;
+	bool closed;
+	std::mutex mtx;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+};
+#endif //BOUNDED_QUEUE_H_
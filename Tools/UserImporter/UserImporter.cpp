@@ -0,0 +1,167 @@
+#include "../../Server/Constants.h"
+#include "../../Server/Storage/UserRecord.h"
+#include "../../Server/Storage/UserStore.h"
+#include "BoundedQueue.h"
+#include <windows.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <regex>
+#include <algorithm>
+#define IMPORT_QUEUE_SIZE 4096
+#define MAX_REPORTED_ERRORS 20
+using namespace std;
+
+/* Totals shared by the worker threads. */
+struct ImportStats {
+	atomic<unsigned long long> files{0};
+	atomic<unsigned long long> bytes{0};
+	atomic<unsigned long long> imported{0};
+	atomic<unsigned long long> errors{0};
+	mutex errorMutex;
+	vector<string> errorMessages;
+};
+
+/* Records a problem with a file, keeping the first MAX_REPORTED_ERRORS messages to print at the end. */
+static void reportError(ImportStats& stats, const string& fileName, const string& message) {
+	stats.errors++;
+	lock_guard<mutex> lock(stats.errorMutex);
+	if(stats.errorMessages.size() < MAX_REPORTED_ERRORS)
+		stats.errorMessages.push_back(fileName + ": " + message);
+}
+
+/* Checks a parsed record against the rules the server enforces. Returns an empty string if it is valid. */
+static string validate(const UserRecord& record, const string& fileName) {
+	static const regex allowedUsernameChars("^[a-zA-Z0-9]*$");
+	if(record.name.empty() || !regex_match(record.name, allowedUsernameChars))
+		return "Invalid username \"" + record.name + "\"";
+	string lowercaseName = record.name;
+	transform(lowercaseName.begin(), lowercaseName.end(), lowercaseName.begin(), ::tolower);
+	string expectedFile = lowercaseName + ".txt";
+	string actualFile = fileName;
+	transform(actualFile.begin(), actualFile.end(), actualFile.begin(), ::tolower);
+	if(actualFile != expectedFile)
+		return "File name doesn't match username " + record.name;
+	if(record.nameColor > 255 || record.chatColor > 255)
+		return "Color out of range";
+	if(record.password.empty())
+		return "Missing password";
+	for(unsigned short i = 0; i < MAX_FRIENDS; i++) {
+		if(!record.friends[i].empty() && !regex_match(record.friends[i], allowedUsernameChars))
+			return "Invalid friend name \"" + record.friends[i] + "\"";
+	}
+	return "";
+}
+
+/* Parses, validates and (unless only verifying) stores files taken off the queue until it is closed. */
+static void importWorker(BoundedQueue<string>& queue, const string& directory, UserStore* store, ImportStats& stats) {
+	string fileName;
+	while(queue.pop(fileName)) {
+		ifstream userFile(directory + fileName, ios::binary | ios::ate);
+		if(!userFile.is_open()) {
+			reportError(stats, fileName, "Could not open");
+			continue;
+		}
+		stats.bytes += userFile.tellg();
+		userFile.seekg(0);
+		stats.files++;
+		try {
+			UserRecord record;
+			record.read(userFile);
+			string error = validate(record, fileName);
+			if(!error.empty()) {
+				reportError(stats, fileName, error);
+				continue;
+			}
+			if(store != nullptr) {
+				string lowercaseName = record.name;
+				transform(lowercaseName.begin(), lowercaseName.end(), lowercaseName.begin(), ::tolower);
+				if(!store->put(lowercaseName, record)) {
+					reportError(stats, fileName, "Could not write to the user store");
+					continue;
+				}
+			}
+			stats.imported++;
+		} catch(exception e) {
+			reportError(stats, fileName, e.what());
+		}
+	}
+}
+
+/* Scans a users directory of version 2 text saves and converts it to the server's binary user store in parallel.
+	Usage: UserImporter [users directory] [--verify]
+	With --verify the files are only parsed and validated, nothing is written.
+*/
+int main(int argc, char* argv[]) {
+	string directory = SAVE_DIRECTORY;
+	bool verifyOnly = false;
+	for(int i = 1; i < argc; i++) {
+		string argument = argv[i];
+		if(argument == "--verify")
+			verifyOnly = true;
+		else
+			directory = argument;
+	}
+	if(directory.back() != '/' && directory.back() != '\\')
+		directory += "/";
+
+	UserStore* store = nullptr;
+	if(!verifyOnly) {
+		try {
+			store = new UserStore(directory);
+		} catch(exception e) {
+			cerr << "Error opening the user store in " << directory << ": " << e.what() << endl;
+			return 1;
+		}
+	}
+
+	ImportStats stats;
+	BoundedQueue<string> queue(IMPORT_QUEUE_SIZE);
+	unsigned int workerCount = max(1u, thread::hardware_concurrency());
+	vector<thread> workers;
+	for(unsigned int i = 0; i < workerCount; i++) {
+		workers.push_back(thread(importWorker, ref(queue), cref(directory), store, ref(stats)));
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	chrono::steady_clock::time_point lastReport = start;
+	WIN32_FIND_DATAA findData;
+	HANDLE search = FindFirstFileA((directory + "*.txt").c_str(), &findData);
+	if(search != INVALID_HANDLE_VALUE) {
+		do {
+			if(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+			queue.push(findData.cFileName);
+			if(chrono::steady_clock::now() - lastReport >= chrono::seconds(1)) {
+				lastReport = chrono::steady_clock::now();
+				cout << stats.files << " files read, " << stats.errors << " errors..." << endl;
+			}
+		} while(FindNextFileA(search, &findData));
+		FindClose(search);
+	}
+	queue.close();
+	for(thread& worker : workers) {
+		worker.join();
+	}
+	if(store != nullptr)
+		store->sync();
+	delete store; //Saves the store's index.
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	if(seconds <= 0)
+		seconds = 0.001;
+	cout << (verifyOnly ? "Verified " : "Imported ") << stats.imported << " of " << stats.files << " files using " << workerCount << " threads in " << seconds << "s." << endl;
+	cout << (unsigned long long)(stats.files / seconds) << " files/s, " << (stats.bytes / seconds / 1024 / 1024) << " MB/s." << endl;
+	cout << stats.errors << " errors." << endl;
+	for(const string& message : stats.errorMessages) {
+		cout << "  " << message << endl;
+	}
+	if(stats.errors > stats.errorMessages.size())
+		cout << "  (" << (stats.errors - stats.errorMessages.size()) << " more not shown)" << endl;
+	return stats.errors > 0 ? 2 : 0;
+}